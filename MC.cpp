@@ -1,107 +1,1261 @@
 #include"MC.h"
+#include"MC_tables.h"
 #include"timer.h"
 #include "stdio.h"
-#include <omp.h>
+#include<climits>
 
-mesh MarchingCubes::compute(float isovalue) {
-	
-	m_isovalue = isovalue;
+// Where extract() puts its results. claim() RETURNS the id for a new vertex,
+// interpolate_edges() writes its data to vertices(), add_triangle() takes a triangle.
+// mesh_output: everything goes to one mesh, vertex ids in order of creation.
+struct mesh_output {
+	mesh& M;
+	explicit mesh_output(mesh& target) : M(target) {}
+	int claim(void) { return M.add_vertex(vec3f(0.0f, 0.0f, 0.0f)); }
+	mesh& vertices(void) { return M; }
+	void add_triangle(const vec3i& t) { M.add_triangle(t); }
+};
+
+// chunk_output: vertices go to a mesh shared by all threads, every thread
+// reserves CHUNK ids at a time with one atomic increment. Triangles go to a
+// mesh of the thread's own.
+struct chunk_output {
+	mesh& chunks;
+	std::atomic<size_t>& next_chunk;
+	std::vector<size_t>& fill;
+	size_t chunk_size;
+	size_t& next;
+	size_t& end;
+	mesh& triangles;
+	int claim(void) {
+		if (next == end) {
+			size_t c = next_chunk.fetch_add(1, std::memory_order_relaxed);
+			assert("chunk_output::claim() -- out of chunks" && c < fill.size());
+			fill[c] = chunk_size;			// corrected for the last chunk of each thread in the end
+			next = c * chunk_size;
+			end = next + chunk_size;
+		}
+		return int(next++);
+	}
+	mesh& vertices(void) { return chunks; }
+	void add_triangle(const vec3i& t) { triangles.add_triangle(t); }
+};
+
+// Edge map of compute() on an implicit field. The edge ids of the slab are
+// turned into ids of the whole grid; edges on the first vertex plane of the
+// slab are shared with the slab below and found in its map first.
+struct slab_edge_map {
+	sparse_edge_map& current;
+	const sparse_edge_map& below;
+	size_t slab_size, grid_size;						// voxels of the slab and of the grid
+	size_t offset;										// grid address of the first voxel of the slab
+	size_t shared_lo, shared_hi;						// slab addresses of the first vertex plane
+	template<class F>
+	int find_or_insert(size_t id, F create) {
+		const size_t axis = id / slab_size, n = id - axis * slab_size;
+		const size_t global = axis * grid_size + offset + n;
+		if (axis < 2 && n >= shared_lo && n < shared_hi) {
+			int vertex = below.find(global);
+			if (vertex != -1) return vertex;
+		}
+		return current.find_or_insert(global, create);
+	}
+};
+
+// Edge map of compute() on a sparse volume. The edge ids of the box being
+// extracted are turned into ids of the whole grid, all boxes share one map.
+struct box_edge_map {
+	sparse_edge_map& edges;
+	size_t box_size, grid_size;							// voxels of the box and of the grid
+	size_t box_x, box_xy;								// voxels of a row and a slice of the box
+	size_t grid_x, grid_xy;								// the same in the grid
+	size_t offset;										// grid address of the first voxel of the box
+	template<class F>
+	int find_or_insert(size_t id, F create) {
+		const size_t axis = id / box_size, n = id - axis * box_size;
+		const size_t z = n / box_xy, y = (n - z * box_xy) / box_x, x = n - z * box_xy - y * box_x;
+		return edges.find_or_insert(axis * grid_size + offset + x + y * grid_x + z * grid_xy, create);
+	}
+};
+
+MarchingCubes::region::region(void) : lo(0, 0, 0), hi(INT_MAX, INT_MAX, INT_MAX) {
+}
+
+MarchingCubes::region::region(const vec3i& lo, const vec3i& hi) : lo(lo), hi(hi) {
+}
 
-	float scale = float(std::max(m_vol.dimension(0), std::max(m_vol.dimension(1), m_vol.dimension(2))));
-	vec3f bias(m_vol.dimension(0) * 0.5f, m_vol.dimension(1) * 0.5f, m_vol.dimension(2) * 0.5f);
-	scale = 2.0f / scale;
+mesh MarchingCubes::compute(float isovalue, progress* prog) {
+	mesh M;
+	compute(isovalue, M, prog);
+	return M;
+}
+
+bool MarchingCubes::compute(float isovalue, mesh& M, progress* prog) {
+	return compute(isovalue, region(), M, prog);
+}
+
+mesh MarchingCubes::compute(float isovalue, const region& roi, progress* prog) {
+	mesh M;
+	compute(isovalue, roi, M, prog);
+	return M;
+}
+
+bool MarchingCubes::compute(float isovalue, const region& roi, mesh& M, progress* prog) {
+	sync_view();
+	m_isovalue = isovalue;
+	m_surface_valid = false;	// m_vertex_tag is about to be overwritten, see update()
+	for (int i = 0; i < 3; i++) {
+		m_lo[i] = std::max(roi.lo[i], 0);
+		m_hi[i] = std::min(roi.hi[i], int(grid_dimension(i)) - 1);
+	}
+	m_planes = roi.planes;
+	if (m_lo.x >= m_hi.x || m_lo.y >= m_hi.y || m_lo.z >= m_hi.z) {
+		M.clear();
+		return true;
+	}
+	if (m_field) return compute_field(M, prog);
+	if (m_sparse) return compute_sparse(M, prog);
 
 	// 1. classify each vertex as larger (PLUS) or less-or-equal (MINUS) the isovalue.
 	//    store result in m_vertex_tag
 	timer ct;
+	prepare_workspace();
 	tag_vertices();
 	printf("vertex tagging took %.2fs\n", ct.query());
 	printf("%zi x %zi x %zi\n", m_vol.dimension(0), m_vol.dimension(1), m_vol.dimension(2));
 
-	mesh M;
-	
+	M.clear();
+	M.reserve(m_last_vertices, m_last_triangles);
+	m_arena.reset();
+	ct.reset();
+
+	// Without a caller supplied progress object, m_console reports once per second.
+	// It has no monitor thread, extract() polls it at the slab boundaries where it
+	// checks for cancellation, and otherwise only bumps its own counter once per row.
+	if (prog == nullptr) prog = &m_console;
+	size_t nCells = size_t(m_hi.x - m_lo.x) * size_t(m_hi.y - m_lo.y) * size_t(m_hi.z - m_lo.z);
+	prog->begin(nCells);
+	bool complete;
+	mesh_output out(M);
+	if (threads() > 1) {
+		complete = m_parallel_mode == UNORDERED ? extract_shared(M, *prog) : extract_bricks(M, *prog);
+	}
+	else if (edge_map() == SPARSE) {
+		complete = extract(m_sparse_edges, out, m_lo, m_hi, m_worker[0], 0, *prog);
+	}
+	else {
+		complete = extract(m_dense_edges, out, m_lo, m_hi, m_worker[0], 0, *prog);
+	}
+	m_sparse_edges.clear();
+	m_dense_edges.clear();
+	prog->end();
+	if (!complete) {
+		printf("\rcancelled after %.2fs\n", ct.query());
+		M.clear();
+		return false;
+	}
+	m_last_vertices = M.nVertices();
+	m_last_triangles = M.nTriangles();
+	printf("\r100.00%% (%.2fs)\n", ct.query());
+	printf("iso=%f, %zi triangles, %zi vertices\n", m_isovalue, M.nTriangles(), M.nVertices());
+	return true;
+}
+
+bool MarchingCubes::compute_field(mesh& M, progress* prog) {
+	// Slab by slab: m_field_slab takes the voxels zb..ze, the cell layers z0..z1-1
+	// and one voxel layer on either side, m_vol views them as a volume at
+	// origin (0,0,zb), and the box of the region is moved into the slab (the
+	// clip planes stay in the grid of the field, see clip_row()). Tagging and the
+	// cell loop are those of compute(). The last three voxel layers of a slab
+	// are the first three of the next, they are moved down, not evaluated again.
+	timer ct;
+	const vec3i lo = m_lo, hi = m_hi;
+	const int dimx = int(m_field->dimension(0)), dimy = int(m_field->dimension(1)), dimz = int(m_field->dimension(2));
+	const size_t slice = size_t(dimx) * size_t(dimy);
+	const size_t slab_voxels = size_t(FIELD_SLAB + 3) * slice;
+	if (m_field_slab.size() != slab_voxels) {
+		decltype(m_field_slab)().swap(m_field_slab);
+		m_field_slab.resize(slab_voxels);
+	}
+	if (m_vertex_tag.size() != slab_voxels) {
+		decltype(m_vertex_tag)().swap(m_vertex_tag);
+		m_vertex_tag.resize(slab_voxels);
+	}
+	m_dense_edges.release();
+	m_sparse_edges.clear();
+	m_field_edges.clear();
+	M.clear();
+	M.reserve(m_last_vertices, m_last_triangles);
+
+	if (prog == nullptr) prog = &m_console;
+	prog->begin(size_t(hi.x - lo.x) * size_t(hi.y - lo.y) * size_t(hi.z - lo.z));
+	mesh_output out(M);
+	bool complete = true;
+	int last_zb = 0, last_ze = -1;						// voxel layers in m_field_slab
+	double evaluation = 0.0;
+	for (int z0 = lo.z; z0 < hi.z && complete; z0 += FIELD_SLAB) {
+		const int z1 = std::min(z0 + FIELD_SLAB, hi.z);
+		const int zb = std::max(z0 - 1, 0), ze = std::min(z1 + 1, dimz - 1);
+		int kept = 0;
+		if (last_ze >= zb) {
+			kept = last_ze - zb + 1;
+			std::copy(m_field_slab.begin() + size_t(zb - last_zb) * slice, m_field_slab.begin() + size_t(last_ze - last_zb + 1) * slice, m_field_slab.begin());
+		}
+		timer et;
+		m_field->evaluate(zb + kept, ze + 1, m_field_slab.data() + size_t(kept) * slice, &pool());
+		evaluation += et.query();
+		last_zb = zb;
+		last_ze = ze;
+
+		m_vol = volume_view(m_field_slab.data(), { dimx, dimy, ze - zb + 1 }, { 1, ptrdiff_t(dimx), ptrdiff_t(slice) }, vec3i(0, 0, zb));
+		prepare_workers();
+		m_lo = vec3i(lo.x, lo.y, z0 - zb);
+		m_hi = vec3i(hi.x, hi.y, z1 - zb);
+		tag_vertices();
+		slab_edge_map edges = { m_sparse_edges, m_field_edges, m_vol.size(), m_field->size(), size_t(zb) * slice,
+			size_t(z0 - zb) * slice, size_t(z0 - zb + 1) * slice };
+		complete = extract(edges, out, m_lo, m_hi, m_worker[0], 0, *prog);
+		std::swap(m_sparse_edges, m_field_edges);
+		m_sparse_edges.clear();
+	}
+	m_sparse_edges.clear();
+	m_field_edges.clear();
+	m_vol = volume_view();
+	m_lo = lo;
+	m_hi = hi;
+	prog->end();
+	if (!complete) {
+		printf("\rcancelled after %.2fs\n", ct.query());
+		M.clear();
+		return false;
+	}
+	m_last_vertices = M.nVertices();
+	m_last_triangles = M.nTriangles();
+	printf("\r100.00%% (%.2fs, field evaluation %.2fs)\n", ct.query(), evaluation);
+	printf("iso=%f, %zi triangles, %zi vertices\n", m_isovalue, M.nTriangles(), M.nVertices());
+	return true;
+}
+
+bool MarchingCubes::compute_sparse(mesh& M, progress* prog) {
+	// Box by box: the cells of leaf box b are LEAF*b..LEAF*(b+1)-1 (cut to the
+	// region), their voxels and one layer around them are copied to
+	// m_field_slab, m_vol views them at their origin in the grid and the cells
+	// are moved into that view, like a slab in compute_field(). Tagging and the
+	// cell loop are those of compute(), the edge ids are those of the grid.
+	// Box b has its corners in the leaves b..b+1, so only the boxes
+	// NODE*N-1..NODE*(N+1)-1 of an allocated node N can reach it; each box is
+	// taken by the first allocated node its leaves are in, none twice.
+	timer ct;
+	const int LEAF = sparse_volume::LEAF, NODE = sparse_volume::NODE;
+	const vec3i lo = m_lo, hi = m_hi;
+	const vec3i dims(int(m_sparse->dimension(0)), int(m_sparse->dimension(1)), int(m_sparse->dimension(2)));
+	const vec3i nodes(m_sparse->node_dimension(0), m_sparse->node_dimension(1), m_sparse->node_dimension(2));
+	const size_t box_voxels = size_t(LEAF + 3) * size_t(LEAF + 3) * size_t(LEAF + 3);
+	if (m_field_slab.size() != box_voxels) {
+		decltype(m_field_slab)().swap(m_field_slab);
+		m_field_slab.resize(box_voxels);
+	}
+	if (m_vertex_tag.size() != box_voxels) {
+		decltype(m_vertex_tag)().swap(m_vertex_tag);
+		m_vertex_tag.resize(box_voxels);
+	}
+	m_dense_edges.release();
+	m_field_edges.release();
+	m_sparse_edges.clear();
+	m_sparse_edges.reserve(m_last_vertices);
+	M.clear();
+	M.reserve(m_last_vertices, m_last_triangles);
+
+	// 1. the boxes the surface can pass through, in the order of the root table
+	std::vector<vec3i> boxes;
+	size_t nCells = 0, nCandidates = 0;
+	auto cells = [&](const vec3i& b, vec3i& c0, vec3i& c1) {
+		for (int i = 0; i < 3; i++) {
+			c0[i] = std::max(LEAF * b[i], lo[i]);
+			c1[i] = std::min(LEAF * (b[i] + 1), hi[i]);
+		}
+	};
+	auto first_node = [&](const vec3i& b) {
+		// the smallest root position of the allocated nodes of leaves b..b+1
+		int first = INT_MAX;
+		for (int d = 0; d < 8; d++) {
+			vec3i node;
+			bool inside = true;
+			for (int i = 0; i < 3; i++) {
+				const int leaf = b[i] + ((d >> i) & 1);
+				inside &= LEAF * leaf < dims[i];
+				node[i] = leaf / NODE;
+			}
+			if (inside && m_sparse->has_node(node)) first = std::min(first, node.x + nodes.x * (node.y + nodes.y * node.z));
+		}
+		return first;
+	};
+	vec3i N, b;
+	for (N.z = 0; N.z < nodes.z; N.z++) {
+		for (N.y = 0; N.y < nodes.y; N.y++) {
+			for (N.x = 0; N.x < nodes.x; N.x++) {
+				if (!m_sparse->has_node(N)) continue;
+				const int root = N.x + nodes.x * (N.y + nodes.y * N.z);
+				vec3i b0, b1;
+				for (int i = 0; i < 3; i++) {
+					b0[i] = std::max(NODE * N[i] - 1, lo[i] / LEAF);
+					b1[i] = std::min(NODE * (N[i] + 1), (hi[i] - 1) / LEAF + 1);
+				}
+				for (b.z = b0.z; b.z < b1.z; b.z++) {
+					for (b.y = b0.y; b.y < b1.y; b.y++) {
+						for (b.x = b0.x; b.x < b1.x; b.x++) {
+							if (first_node(b) != root) continue;
+							nCandidates++;
+							if (!sparse_active(b)) continue;
+							vec3i c0, c1;
+							cells(b, c0, c1);
+							boxes.push_back(b);
+							nCells += size_t(c1.x - c0.x) * size_t(c1.y - c0.y) * size_t(c1.z - c0.z);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// 2. extraction box by box
+	if (prog == nullptr) prog = &m_console;
+	prog->begin(nCells);
+	mesh_output out(M);
+	bool complete = true;
+	for (size_t n = 0; n < boxes.size() && complete; n++) {
+		vec3i c0, c1, v0, v1;
+		cells(boxes[n], c0, c1);
+		for (int i = 0; i < 3; i++) {
+			v0[i] = std::max(c0[i] - 1, 0);
+			v1[i] = std::min(c1[i] + 2, dims[i]);
+		}
+		m_sparse->copy(v0, v1, m_field_slab.data());
+		const vec3i d = v1 - v0;
+		m_vol = volume_view(m_field_slab.data(), { d.x, d.y, d.z }, { 1, ptrdiff_t(d.x), ptrdiff_t(d.x) * ptrdiff_t(d.y) }, v0);
+		prepare_workers();
+		m_lo = c0 - v0;
+		m_hi = c1 - v0;
+		for (int z = m_lo.z; z <= m_hi.z; z++) tag_slice(z);
+		box_edge_map edges = { m_sparse_edges, m_vol.size(), m_sparse->size(), size_t(d.x), size_t(d.x) * size_t(d.y),
+			size_t(dims.x), size_t(dims.x) * size_t(dims.y), size_t(v0.x) + size_t(dims.x) * (size_t(v0.y) + size_t(dims.y) * size_t(v0.z)) };
+		complete = extract(edges, out, m_lo, m_hi, m_worker[0], 0, *prog);
+	}
+	m_sparse_edges.clear();
+	m_vol = volume_view();
+	m_lo = lo;
+	m_hi = hi;
+	prog->end();
+	if (!complete) {
+		printf("\rcancelled after %.2fs\n", ct.query());
+		M.clear();
+		return false;
+	}
+	m_last_vertices = M.nVertices();
+	m_last_triangles = M.nTriangles();
+	printf("\r100.00%% (%.2fs, %zu of %zu boxes)\n", ct.query(), boxes.size(), nCandidates);
+	printf("iso=%f, %zi triangles, %zi vertices\n", m_isovalue, M.nTriangles(), M.nVertices());
+	return true;
+}
+
+bool MarchingCubes::sparse_active(const vec3i& box) const {
+	// the corners of the cells are in the leaves box..box+1 inside the grid;
+	// all above or all at or below the isovalue gives no triangles (NaN ranges
+	// are neither)
+	bool above = true, below = true;
+	for (int d = 0; d < 8; d++) {
+		vec3i leaf;
+		bool inside = true;
+		for (int i = 0; i < 3; i++) {
+			leaf[i] = box[i] + ((d >> i) & 1);
+			inside &= sparse_volume::LEAF * leaf[i] < int(m_sparse->dimension(i));
+		}
+		if (!inside) continue;
+		const sparse_volume::slot s = m_sparse->find(leaf);
+		above &= s.lo > m_isovalue;
+		below &= s.hi <= m_isovalue;
+	}
+	return !above && !below;
+}
+
+template<class EdgeMap, class Output>
+bool MarchingCubes::extract(EdgeMap& edge_map, Output& out, const vec3i& lo, const vec3i& hi, worker_space& W, int worker, progress& prog,
+	std::vector<std::pair<int, size_t>>* shared) {
+	vec3f bias;
+	float scale;
+	model_transform(bias, scale);
+
 	// 2. compute vertices on all relevant edges. 
-	//    For this, we will iterate all (Nx-1)*(Ny-1)*(Nz-1) cells.
-	// We will use a std::vector (list in python) to keep track of vertices
+	//    For this, we will iterate all cells from lo to hi, all (Nx-1)*(Ny-1)*(Nz-1)
+	//    of them unless we are working on a brick.
+	// We will use edge_map to keep track of vertices
 	// we have already computed. This will (a) save redundant computation and
 	// (b) ensure that the vertex along an ande "from the left" is exactly
 	// (as opposed to with rounding error) the same as the vertex "from the right"
-	std::vector<int> hash;
-	hash.resize(3 * m_vol.size(), -1); // initial value -1 indicates not yet computed
+	// All addressing is linear: neighbors along x, y, z are 1, sy and sz apart in
+	// memory, so the edges of a cell are constant offsets from its first vertex
+	// (base). Edge ids are axis*size + address of the lower end, see edge_id().
+	const size_t sy = m_vol.dimension(0), sz = m_vol.dimension(0) * m_vol.dimension(1);
+	size_t edge_delta[12];
+	for (int e = 0; e < 12; e++) {
+		const std::array<int8_t, 4>& E = mc_edge_offset[e];
+		edge_delta[e] = size_t(E[3]) * m_vol.size() + E[0] + E[1] * sy + E[2] * sz;
+	}
+	// A vertex is shared with a neighboring brick if it lies on a face of this
+	// brick that is not on the boundary of the extracted region.
+	vec3i share_lo, share_hi;
+	for (int i = 0; i < 3; i++) {
+		share_lo[i] = lo[i] > m_lo[i] ? lo[i] : -1;
+		share_hi[i] = hi[i] < m_hi[i] ? hi[i] : -1;
+	}
+	uint8_t* row_code = W.row_code.data();
+	int* row_active = W.row_active.data();
 	vec3i vox;
-	ct.reset();
-	timer ctEvent;
-	size_t nCells = (m_vol.dimension(0) - 1) * (m_vol.dimension(1) - 1) * (m_vol.dimension(2) - 2);
-	size_t nDone = 0;
-	//#pragma omp parallel for collapse (3)
-	for (vox.z = 0; vox.z < m_vol.dimension(2) - 1; vox.z++) {
-		//#pragma omp parallel for
-		for (vox.y = 0; vox.y < m_vol.dimension(1) - 1; vox.y++) {
-			if (ctEvent.query() > 1.0) {
-				ctEvent.reset();
-				printf("\r%.2f%% (%.2fs)", float(double(nDone) / double(nCells) * 100.0),ct.query()); fflush(stdout);
-			}
-			//#pragma omp parallel for
-			for (vox.x = 0; vox.x < m_vol.dimension(0) - 1; vox.x++) {
-				nDone++;
-				uint8_t code = compute_cell_code(vox);
-				int edge_code = edge_table[code];
-				int local_edge = 0;
-				while (edge_code > 0) {
-					if ((edge_code & 1)!=0) {
-						// this edge needs a vertex. 
-						// Compute the two sample positions at the edge
-						vec3i pos1 = vox + vertex_offset[edges[2 * local_edge]];
-						vec3i pos2 = vox + vertex_offset[edges[2 * local_edge + 1]];
-						// Now, assign a unique ID to the edge
-						size_t id = edge_id(pos1, pos2);
-						// If we did not comput this vector in the past, do it now and add to mesh
-						if (hash[id] == -1) {
-							// compute position, normal, color and add to mesh
-							vec3f pos, norm, color;
-							edge_vertex(pos1, pos2, pos, norm, color);
-							// store for later
-							pos = (pos-bias)*scale;
-							hash[id] = M.add_vertex(pos, norm, color);
+	for (vox.z = lo.z; vox.z < hi.z; vox.z++) {
+		// slab boundary: a slab is one slice of cells here
+		if (prog.cancelled()) return false;
+		prog.poll();
+		for (vox.y = lo.y; vox.y < hi.y; vox.y++) {
+			const size_t row = linear_address(vec3i(0, vox.y, vox.z));
+			// codes of the whole row at once, only cells with triangles are visited below
+			int x0 = lo.x, x1 = hi.x;
+			int nActive = clip_row(vox.y, vox.z, x0, x1) ? cell_codes(vox.y, vox.z, x0, x1, row_code, row_active) : 0;
+			for (int i = 0; i < nActive; i++) {
+				vox.x = row_active[i];
+				const size_t base = row + vox.x;
+				const mc_case& c = mc_cases[row_code[vox.x]];
+				int cell_vertex[12];	// vertex ids of the case's active edges
+				for (int e = 0; e < c.nEdges; e++) {
+					// this edge needs a vertex
+					size_t id = base + edge_delta[c.edge[e]];
+					// If we did not comput this vector in the past, do it now and add to mesh
+					cell_vertex[e] = edge_map.find_or_insert(id, [&]() {
+						// claim the vertex now, position, normal and color follow with the batch
+						const std::array<int8_t, 4>& E = mc_edge_offset[c.edge[e]];
+						const vec3i pos1(vox.x + E[0], vox.y + E[1], vox.z + E[2]);
+						int vertex = out.claim();
+						gather_edge(W.batch, pos1, E[3], vertex);
+						if (shared) {
+							for (int a = 0; a < 3; a++) {
+								if (a != E[3] && (pos1[a] == share_lo[a] || pos1[a] == share_hi[a])) {
+									shared->push_back(std::make_pair(vertex, id));
+									break;
+								}
+							}
 						}
-					}
-					// shift bits left
-					edge_code >>= 1;
-					// increment local_edge code
-					local_edge++;
+						return vertex;
+					});
 				}
 				// Now we have all edges we need, at least for this cell.
 				// FACE-TIME!
-				int p = 0;
-				while (triTable[code][p] != -1) {
-					vec3i triangle;
-					for (int v = 0; v<3; v++) { // three vertices
-						int local_edge = triTable[code][p+v];
-						vec3i pos1 = vox + vertex_offset[edges[2 * local_edge]];
-						vec3i pos2 = vox + vertex_offset[edges[2 * local_edge + 1]];
-						size_t id = edge_id(pos1, pos2);
-						triangle[v] = hash[id];
+				for (int t = 0; t < 3 * c.nTriangles; t += 3) {
+					out.add_triangle(vec3i(cell_vertex[c.triangle[t]], cell_vertex[c.triangle[t + 1]], cell_vertex[c.triangle[t + 2]]));
+				}
+			}
+			if (W.batch.size >= edge_batch::FLUSH) interpolate_edges(W.batch, bias, scale, out.vertices());
+			prog.advance(worker, size_t(hi.x - lo.x));
+		}
+		interpolate_edges(W.batch, bias, scale, out.vertices());
+	}
+	return true;
+}
+
+void MarchingCubes::make_bricks(void) {
+	vec3i nBricks;
+	for (int i = 0; i < 3; i++) nBricks[i] = (m_hi[i] - m_lo[i] + BRICK - 1) / BRICK;
+	m_bricks.resize(size_t(nBricks.x) * nBricks.y * nBricks.z);
+	size_t b = 0;
+	vec3i n;
+	for (n.z = 0; n.z < nBricks.z; n.z++) {
+		for (n.y = 0; n.y < nBricks.y; n.y++) {
+			for (n.x = 0; n.x < nBricks.x; n.x++, b++) {
+				m_bricks[b].lo = m_lo + n * BRICK;
+				for (int i = 0; i < 3; i++) m_bricks[b].hi[i] = std::min(m_lo[i] + (n[i] + 1) * BRICK, m_hi[i]);
+			}
+		}
+	}
+}
+
+bool MarchingCubes::extract_bricks(mesh& M, progress& prog) {
+	thread_pool& P = pool();
+	P.reset_statistics();
+	make_bricks();
+
+	// every worker extracts bricks with its own scratch and a brick local edge map
+	P.run(m_bricks.size(), [&](size_t task, int worker) {
+		brick& B = m_bricks[task];
+		worker_space& W = m_worker[worker];
+		B.M.clear();
+		B.shared.clear();
+		W.edges.clear();
+		mesh_output out(B.M);
+		extract(W.edges, out, B.lo, B.hi, W, worker, prog, &B.shared);
+	});
+	if (prog.cancelled()) return false;
+
+	if (edge_map() == SPARSE) stitch(m_sparse_edges, M);
+	else stitch(m_dense_edges, M);
+	return true;
+}
+
+template<class EdgeMap>
+void MarchingCubes::stitch(EdgeMap& edge_map, mesh& M) {
+	// 1. provisional ids: local vertex v of brick B is B.first + v
+	size_t nProvisional = 0;
+	for (brick& B : m_bricks) {
+		B.first = int(nProvisional);
+		nProvisional += B.M.nVertices();
+	}
+	assert("MarchingCubes::stitch() -- too many vertices" && nProvisional <= size_t(INT32_MAX));
+	// m_stitch is -1 for vertices to keep, -2-owner for duplicates of the provisional id owner
+	m_stitch.assign(nProvisional, -1);
+
+	// 2. the first brick (in brick order) that created a shared vertex owns it.
+	//    Only the shared vertices are looked at here, this is the serial part.
+	size_t nVertices = 0, nTriangles = 0;
+	for (brick& B : m_bricks) {
+		B.kept = int(B.M.nVertices());
+		for (const auto& s : B.shared) {
+			int p = B.first + s.first;
+			int owner = edge_map.find(s.second);
+			if (owner == -1) edge_map.insert(s.second, p);
+			else {
+				m_stitch[p] = -2 - owner;
+				B.kept--;
+			}
+		}
+		B.vertex_offset = nVertices;
+		B.triangle_offset = nTriangles;
+		nVertices += size_t(B.kept);
+		nTriangles += B.M.nTriangles();
+	}
+	M.resize(nVertices, nTriangles);
+
+	// 3. kept vertices get consecutive ids in brick order
+	thread_pool& P = pool();
+	P.run(m_bricks.size(), [&](size_t task, int) {
+		const brick& B = m_bricks[task];
+		int next = int(B.vertex_offset);
+		for (int v = 0; v < int(B.M.nVertices()); v++) {
+			int& id = m_stitch[B.first + v];
+			if (id != -1) continue;
+			id = next++;
+			M.position(id) = B.M.position(v);
+			M.normal(id) = B.M.normal(v);
+			M.color(id) = B.M.color(v);
+		}
+	});
+	// 4. duplicates take the id of their owner, which is final after step 3
+	P.run(m_bricks.size(), [&](size_t task, int) {
+		const brick& B = m_bricks[task];
+		for (const auto& s : B.shared) {
+			int& id = m_stitch[B.first + s.first];
+			if (id < -1) id = m_stitch[-2 - id];
+		}
+		const int* remap = m_stitch.data() + B.first;
+		for (int t = 0; t < int(B.M.nTriangles()); t++) {
+			const vec3i& tri = B.M.triangle(t);
+			M.triangle(int(B.triangle_offset) + t) = vec3i(remap[tri.x], remap[tri.y], remap[tri.z]);
+		}
+	});
+}
+
+bool MarchingCubes::extract_shared(mesh& M, progress& prog) {
+	thread_pool& P = pool();
+	P.reset_statistics();
+	make_bricks();
+
+	// The number of vertices is known exactly before extracting: one per edge
+	// whose ends have different tags. That sizes the edge map, which cannot
+	// grow while the threads use it, and bounds the number of chunks.
+	size_t nVertices = count_edge_vertices();
+	m_concurrent_edges.reserve(nVertices);
+	size_t nChunks = (nVertices + CHUNK - 1) / CHUNK + size_t(P.size());
+	m_chunks.resize(nChunks * CHUNK, 0);
+	m_chunk_fill.assign(nChunks, 0);
+	m_next_chunk.store(0, std::memory_order_relaxed);
+	for (worker_space& W : m_worker) {
+		W.chunk_next = W.chunk_end = 0;
+		W.triangles.clear();
+	}
+
+	P.run(m_bricks.size(), [&](size_t task, int worker) {
+		const brick& B = m_bricks[task];
+		worker_space& W = m_worker[worker];
+		chunk_output out = { m_chunks, m_next_chunk, m_chunk_fill, CHUNK, W.chunk_next, W.chunk_end, W.triangles };
+		extract(m_concurrent_edges, out, B.lo, B.hi, W, worker, prog);
+	});
+	m_concurrent_edges.clear();
+	if (prog.cancelled()) return false;
+
+	// The last chunk of every thread is only partly used. Chunks are packed
+	// in chunk order, vertex id i becomes offset[i/CHUNK] + i%CHUNK.
+	for (worker_space& W : m_worker) {
+		if (W.chunk_end > W.chunk_next) m_chunk_fill[W.chunk_next / CHUNK] -= W.chunk_end - W.chunk_next;
+	}
+	nChunks = m_next_chunk.load(std::memory_order_relaxed);
+	std::vector<size_t, arena_allocator<size_t>> offset(nChunks + 1, 0, arena_allocator<size_t>(&m_arena));
+	for (size_t c = 0; c < nChunks; c++) offset[c + 1] = offset[c] + m_chunk_fill[c];
+	std::vector<size_t, arena_allocator<size_t>> first_triangle(m_worker.size() + 1, 0, arena_allocator<size_t>(&m_arena));
+	for (size_t w = 0; w < m_worker.size(); w++) first_triangle[w + 1] = first_triangle[w] + m_worker[w].triangles.nTriangles();
+	assert("MarchingCubes::extract_shared() -- vertex count mismatch" && (offset[nChunks] == nVertices || (!m_planes.empty() && offset[nChunks] < nVertices)));
+	M.resize(offset[nChunks], first_triangle.back());
+
+	P.run(nChunks, [&](size_t c, int) {
+		for (size_t i = 0; i < m_chunk_fill[c]; i++) {
+			int from = int(c * CHUNK + i), to = int(offset[c] + i);
+			M.position(to) = m_chunks.position(from);
+			M.normal(to) = m_chunks.normal(from);
+			M.color(to) = m_chunks.color(from);
+		}
+	});
+	P.run(m_worker.size(), [&](size_t w, int) {
+		const mesh& T = m_worker[w].triangles;
+		for (int t = 0; t < int(T.nTriangles()); t++) {
+			const vec3i& tri = T.triangle(t);
+			vec3i& result = M.triangle(int(first_triangle[w]) + t);
+			for (int k = 0; k < 3; k++) result[k] = int(offset[size_t(tri[k]) / CHUNK] + size_t(tri[k]) % CHUNK);
+		}
+	});
+	return true;
+}
+
+size_t MarchingCubes::count_edge_vertices(void) {
+	thread_pool& P = pool();
+	// the edges between the voxels of the region, an upper bound if it is clipped
+	const size_t sy = m_vol.dimension(0), sz = m_vol.dimension(0) * m_vol.dimension(1);
+	for (worker_space& W : m_worker) W.count = 0;
+	P.run(size_t(m_hi.z - m_lo.z + 1), [&](size_t task, int worker) {
+		const int z = m_lo.z + int(task);
+		size_t count = 0;
+		for (int y = m_lo.y; y <= m_hi.y; y++) {
+			const uint8_t* t = m_vertex_tag.data() + linear_address(vec3i(0, y, z));
+			for (int x = m_lo.x; x < m_hi.x; x++) count += t[x] != t[x + 1];
+			if (y < m_hi.y) for (int x = m_lo.x; x <= m_hi.x; x++) count += t[x] != t[x + sy];
+			if (z < m_hi.z) for (int x = m_lo.x; x <= m_hi.x; x++) count += t[x] != t[x + sz];
+		}
+		m_worker[worker].count += count;
+	});
+	size_t result = 0;
+	for (const worker_space& W : m_worker) result += W.count;
+	return result;
+}
+
+MarchingCubes::counts MarchingCubes::count(float isovalue) {
+	sync_view();
+	counts result = { 0, 0, 0 };
+	if (streamed()) return result;
+	const int dimx = int(m_vol.dimension(0)), dimy = int(m_vol.dimension(1)), dimz = int(m_vol.dimension(2));
+	if (dimx < 2 || dimy < 2 || dimz < 2) return result;
+	prepare_workers();
+	// a row of tags takes nWords words, a slice nWords*dimy
+	const size_t nWords = size_t(dimx + 63) / 64, slice = nWords * size_t(dimy);
+	for (worker_space& W : m_worker) {
+		W.count = W.count_triangles = W.count_cells = 0;
+		for (auto& b : W.slice_bits) b.resize(slice);
+	}
+	// Bit x of the words below stands for the edge or cell starting at x,
+	// which exists for x < dimx-1 only.
+	const int nLast = dimx - 1 - 64 * int(nWords - 1);
+	const uint64_t last = nLast == 0 ? 0 : ~uint64_t(0) >> (64 - nLast);
+	auto valid = [&](size_t k) { return k + 1 < nWords ? ~uint64_t(0) : last; };
+	// bit x+1 of a row at bit x
+	auto next = [&](const uint64_t* row, size_t k) { return (row[k] >> 1) | (k + 1 < nWords ? row[k + 1] << 63 : 0); };
+	// rows of a view with gaps between the voxels are packed first
+	const ptrdiff_t sx = m_vol.stride(0);
+	auto tag_slice = [&](int z, uint64_t* bits, worker_space& W) {
+		if (sx == 1) {
+			for (int y = 0; y < dimy; y++) tag_bits(&m_vol(0, y, z), dimx, isovalue, bits + size_t(y) * nWords);
+			return;
+		}
+		W.row_values.resize(size_t(dimx));
+		for (int y = 0; y < dimy; y++) {
+			const float* v = &m_vol(0, y, z);
+			for (int x = 0; x < dimx; x++) W.row_values[x] = v[ptrdiff_t(x) * sx];
+			tag_bits(W.row_values.data(), dimx, isovalue, bits + size_t(y) * nWords);
+		}
+	};
+	// edges along x and y within a slice
+	auto slice_edges = [&](const uint64_t* bits) {
+		size_t n = 0;
+		for (int y = 0; y < dimy; y++) {
+			const uint64_t* row = bits + size_t(y) * nWords;
+			for (size_t k = 0; k < nWords; k++) {
+				n += size_t(simd_popcount((row[k] ^ next(row, k)) & valid(k)));
+				if (y + 1 < dimy) n += size_t(simd_popcount(row[k] ^ row[k + nWords]));
+			}
+		}
+		return n;
+	};
+
+	// Slab s holds the cell layers z0..z1-1 and counts the edges within the
+	// slices z0..z1-1 plus the ones between them, the last one also slice dimz-1.
+	// Each slice but the first of a slab is tagged once.
+	const int nSlabs = (dimz - 1 + COUNT_SLAB - 1) / COUNT_SLAB;
+	pool().run(size_t(nSlabs), [&](size_t s, int worker) {
+		worker_space& W = m_worker[worker];
+		const int z0 = int(s) * COUNT_SLAB, z1 = std::min(z0 + COUNT_SLAB, dimz - 1);
+		uint64_t* lo = W.slice_bits[0].data();
+		uint64_t* hi = W.slice_bits[1].data();
+		size_t vertices = 0, triangles = 0, cells = 0;
+		tag_slice(z0, lo, W);
+		for (int z = z0; z < z1; z++) {
+			tag_slice(z + 1, hi, W);
+			vertices += slice_edges(lo);
+			for (size_t k = 0; k < slice; k++) vertices += size_t(simd_popcount(lo[k] ^ hi[k]));
+			for (int y = 0; y + 1 < dimy; y++) {
+				// the four rows around the cells, named like r[] of the cell code kernels
+				const uint64_t* r0 = lo + size_t(y) * nWords, * r1 = r0 + nWords, * r2 = hi + size_t(y) * nWords, * r3 = r2 + nWords;
+				for (size_t k = 0; k < nWords; k++) {
+					const uint64_t a0 = r0[k], a1 = next(r0, k), b0 = r1[k], b1 = next(r1, k);
+					const uint64_t c0 = r2[k], c1 = next(r2, k), d0 = r3[k], d1 = next(r3, k);
+					const uint64_t full = a0 & a1 & b0 & b1 & c0 & c1 & d0 & d1;
+					const uint64_t any = a0 | a1 | b0 | b1 | c0 | c1 | d0 | d1;
+					uint64_t active = any & ~full & valid(k);
+					cells += size_t(simd_popcount(active));
+					for (; active != 0; active &= active - 1) {
+						const int i = simd_ctz(active);
+						const int code = int((c0 >> i) & 1) | int((c1 >> i) & 1) << 1 | int((a1 >> i) & 1) << 2 | int((a0 >> i) & 1) << 3
+							| int((d0 >> i) & 1) << 4 | int((d1 >> i) & 1) << 5 | int((b1 >> i) & 1) << 6 | int((b0 >> i) & 1) << 7;
+						triangles += size_t(mc_cases[code].nTriangles);
 					}
-					M.add_triangle(triangle);
-					p += 3;
 				}
 			}
+			std::swap(lo, hi);
 		}
+		if (z1 == dimz - 1) vertices += slice_edges(lo);
+		W.count += vertices;
+		W.count_triangles += triangles;
+		W.count_cells += cells;
+	});
+	for (const worker_space& W : m_worker) {
+		result.vertices += W.count;
+		result.triangles += W.count_triangles;
+		result.cells += W.count_cells;
 	}
-	//clear();
-	printf("\r100.00%% (%.2fs)\n", ct.query());
-	printf("iso=%f, %zi triangles, %zi vertices\n", m_isovalue, M.nTriangles(), M.nVertices());
-	return M;
+	return result;
+}
+
+bool MarchingCubes::propagate(float isovalue, const std::vector<vec3i>& seeds, mesh& M, progress* prog) {
+	sync_view();
+	if (streamed()) {
+		M.clear();
+		return true;
+	}
+	m_isovalue = isovalue;		// the tags are not touched, update() stays valid
+	timer ct;
+	prepare_workers();
+	M.clear();
+	const size_t nCells = m_vol.empty() ? 0 : (m_vol.dimension(0) - 1) * (m_vol.dimension(1) - 1) * (m_vol.dimension(2) - 1);
+	if (m_seen_cells.size() != (nCells + 63) / 64) {
+		decltype(m_seen_cells)().swap(m_seen_cells);
+		m_seen_cells.resize((nCells + 63) / 64, 0);
+	}
+
+	// The size of the surface is not known up front, the spectrum of the
+	// volume gives an estimate for the progress report if there is one.
+	progress quiet;
+	if (prog == nullptr) prog = &quiet;
+	const contour_spectrum* spectrum = m_vol.spectrum();
+	prog->begin(spectrum ? spectrum->estimate(isovalue).triangles : 0);
+	bool complete;
+	if (edge_map() == SPARSE) {
+		m_dense_edges.release();
+		complete = flood(m_sparse_edges, seeds, M, *prog);
+	}
+	else {
+		m_sparse_edges.release();
+		m_dense_edges.resize(3 * m_vol.size());
+		complete = flood(m_dense_edges, seeds, M, *prog);
+	}
+	m_sparse_edges.clear();
+	m_dense_edges.clear();
+	prog->end();
+	if (!complete) {
+		M.clear();
+		return false;
+	}
+	printf("iso=%f, %zi triangles, %zi vertices, %zi cells from %zi seeds, propagation took %.2fs\n",
+		m_isovalue, M.nTriangles(), M.nVertices(), m_front.size(), seeds.size(), ct.query());
+	return true;
+}
+
+template<class EdgeMap>
+bool MarchingCubes::flood(EdgeMap& edge_map, const std::vector<vec3i>& seeds, mesh& M, progress& prog) {
+	worker_space& W = m_worker[0];
+	vec3f bias;
+	float scale;
+	model_transform(bias, scale);
+
+	// corners (in memory) and edge ids as constant offsets from the first vertex of a cell, see extract()
+	const size_t sy = m_vol.dimension(0), sz = m_vol.dimension(0) * m_vol.dimension(1);
+	ptrdiff_t corner_delta[8];
+	size_t edge_delta[12];
+	for (int i = 0; i < 8; i++) corner_delta[i] = mc_corner[i][0] * m_vol.stride(0) + mc_corner[i][1] * m_vol.stride(1) + mc_corner[i][2] * m_vol.stride(2);
+	for (int e = 0; e < 12; e++) {
+		const std::array<int8_t, 4>& E = mc_edge_offset[e];
+		edge_delta[e] = size_t(E[3]) * m_vol.size() + E[0] + E[1] * sy + E[2] * sz;
+	}
+	// corners of the faces: face 2*a+s lies at offset s along axis a
+	uint8_t face_mask[6] = { 0 };
+	for (int i = 0; i < 8; i++) {
+		for (int a = 0; a < 3; a++) face_mask[2 * a + mc_corner[i][a]] |= uint8_t(1 << i);
+	}
+	const vec3i last_cell(int(m_vol.dimension(0)) - 2, int(m_vol.dimension(1)) - 2, int(m_vol.dimension(2)) - 2);
+	auto code_of = [&](const vec3i& cell) {
+		const float* v = &m_vol(cell);
+		int code = 0;
+		for (int i = 0; i < 8; i++) code |= int(v[corner_delta[i]] > m_isovalue) << i;
+		return uint8_t(code);
+	};
+	auto inside = [&](const vec3i& cell) {
+		return cell.x >= 0 && cell.y >= 0 && cell.z >= 0 && cell.x <= last_cell.x && cell.y <= last_cell.y && cell.z <= last_cell.z;
+	};
+	// marks a cell as seen, RETURNS false if it was already
+	auto visit = [&](const vec3i& cell) {
+		const size_t n = size_t(cell.x) + size_t(last_cell.x + 1) * (size_t(cell.y) + size_t(last_cell.y + 1) * size_t(cell.z));
+		const uint64_t bit = uint64_t(1) << (n % 64);
+		if (m_seen_cells[n / 64] & bit) return false;
+		m_seen_cells[n / 64] |= bit;
+		return true;
+	};
+
+	m_front.clear();
+	for (const vec3i& cell : seeds) {
+		if (!inside(cell)) continue;
+		uint8_t code = code_of(cell);
+		if (code != 0 && code != 255 && visit(cell)) m_front.push_back(cell);
+	}
+	bool complete = true;
+	for (size_t head = 0; head < m_front.size(); head++) {
+		if (head % 4096 == 0 && prog.cancelled()) {
+			complete = false;
+			break;
+		}
+		const vec3i cell = m_front[head];
+		const size_t base = linear_address(cell);
+		const uint8_t code = code_of(cell);
+		const mc_case& c = mc_cases[code];
+		int cell_vertex[12];
+		for (int e = 0; e < c.nEdges; e++) {
+			cell_vertex[e] = edge_map.find_or_insert(base + edge_delta[c.edge[e]], [&]() {
+				const std::array<int8_t, 4>& E = mc_edge_offset[c.edge[e]];
+				int vertex = M.add_vertex(vec3f(0.0f, 0.0f, 0.0f));
+				gather_edge(W.batch, vec3i(cell.x + E[0], cell.y + E[1], cell.z + E[2]), E[3], vertex);
+				return vertex;
+			});
+		}
+		for (int t = 0; t < 3 * c.nTriangles; t += 3) {
+			M.add_triangle(vec3i(cell_vertex[c.triangle[t]], cell_vertex[c.triangle[t + 1]], cell_vertex[c.triangle[t + 2]]));
+		}
+		if (W.batch.size >= edge_batch::FLUSH) interpolate_edges(W.batch, bias, scale, M);
+		prog.advance(0, size_t(c.nTriangles));
+
+		// the surface continues into the neighbors across the faces it cuts
+		for (int f = 0; f < 6; f++) {
+			const uint8_t face = code & face_mask[f];
+			if (face == 0 || face == face_mask[f]) continue;
+			vec3i next = cell;
+			next[f / 2] += (f & 1) ? 1 : -1;
+			if (inside(next) && visit(next)) m_front.push_back(next);
+		}
+	}
+	interpolate_edges(W.batch, bias, scale, M);
+	// unmark exactly the cells that were marked, like dense_edge_map::clear()
+	for (const vec3i& cell : m_front) {
+		const size_t n = size_t(cell.x) + size_t(last_cell.x + 1) * (size_t(cell.y) + size_t(last_cell.y + 1) * size_t(cell.z));
+		m_seen_cells[n / 64] = 0;
+	}
+	return complete;
+}
+
+std::vector<vec3i> MarchingCubes::find_seeds(float isovalue, const vec3i& start) const {
+	sync_view();
+	std::vector<vec3i> seeds;
+	if (streamed()) return seeds;
+	const vec3i dims(int(m_vol.dimension(0)), int(m_vol.dimension(1)), int(m_vol.dimension(2)));
+	if (dims.x < 2 || dims.y < 2 || dims.z < 2) return seeds;
+	assert("MarchingCubes::find_seeds() -- invalid argument" && start.x >= 0 && start.y >= 0 && start.z >= 0 && start.x < dims.x && start.y < dims.y && start.z < dims.z);
+	const bool side = m_vol(start) > isovalue;
+	for (int f = 0; f < 6; f++) {
+		const int a = f / 2, step = (f & 1) ? 1 : -1;
+		vec3i p = start;
+		for (p[a] += step; p[a] >= 0 && p[a] < dims[a]; p[a] += step) {
+			if ((m_vol(p) > isovalue) == side) continue;
+			// the edge from p - step to p crosses, any cell that contains it does
+			vec3i cell = p;
+			cell[a] = std::min(p[a], p[a] - step);
+			for (int b = 0; b < 3; b++) {
+				if (b != a) cell[b] = std::min(cell[b], dims[b] - 2);
+			}
+			seeds.push_back(cell);
+			break;
+		}
+	}
+	return seeds;
+}
+
+std::vector<vec3i> MarchingCubes::find_seeds(float isovalue, bool maximum) const {
+	// Sequential scans, much cheaper than visiting the cells: the extreme value
+	// with independent lanes the compiler can keep in vector registers, then
+	// the first voxel that has it.
+	sync_view();
+	if (streamed() || m_vol.empty()) return std::vector<vec3i>();
+	const float sign = maximum ? 1.0f : -1.0f;
+	if (!m_vol.contiguous()) {
+		// a view with gaps, voxel by voxel
+		vec3i best(0, 0, 0);
+		float extreme = sign * m_vol(best);
+		for (int z = 0; z < int(m_vol.dimension(2)); z++) {
+			for (int y = 0; y < int(m_vol.dimension(1)); y++) {
+				const float* v = m_vol.data() + m_vol.address(0, y, z);
+				for (int x = 0; x < int(m_vol.dimension(0)); x++) {
+					if (sign * v[ptrdiff_t(x) * m_vol.stride(0)] > extreme) {
+						extreme = sign * v[ptrdiff_t(x) * m_vol.stride(0)];
+						best = vec3i(x, y, z);
+					}
+				}
+			}
+		}
+		return find_seeds(isovalue, best);
+	}
+	const float* data = m_vol.data();
+	const size_t size = m_vol.size();
+	float lane[16];
+	for (int k = 0; k < 16; k++) lane[k] = sign * data[0];
+	size_t n = 0;
+	for (; n + 16 <= size; n += 16) {
+		for (int k = 0; k < 16; k++) lane[k] = std::max(lane[k], sign * data[n + k]);
+	}
+	for (; n < size; n++) lane[0] = std::max(lane[0], sign * data[n]);
+	const float extreme = sign * *std::max_element(lane, lane + 16);
+	n = size_t(std::find(data, data + size, extreme) - data);
+	const size_t dx = m_vol.dimension(0), dy = m_vol.dimension(1);
+	return find_seeds(isovalue, vec3i(int(n % dx), int((n / dx) % dy), int(n / (dx * dy))));
+}
+
+const mesh& MarchingCubes::update(float isovalue, mesh_delta* delta) {
+	sync_view();
+	if (delta) delta->clear();
+	if (streamed()) {
+		m_surface.clear();
+		return m_surface;
+	}
+	std::array<size_t, 3> dims = { m_vol.dimension(0), m_vol.dimension(1), m_vol.dimension(2) };
+	if (!m_surface_valid || dims != m_workspace_dims) {
+		m_isovalue = isovalue;
+		rebuild_surface(delta);
+		return m_surface;
+	}
+	if (isovalue == m_surface_isovalue) return m_surface;
+
+	timer ct;
+	float old_isovalue = m_surface_isovalue;
+	m_isovalue = m_surface_isovalue = isovalue;
+	m_surface_exact = false;
+
+	// 1. re-tag, remembering the vertices that changed sides
+	retag_vertices(old_isovalue);
+	const std::vector<size_t>& flipped = m_flipped;
+
+	// 2. only the up to 8 cells around a flipped vertex can change their code,
+	//    and each of them does. A cell seen twice already has its new code.
+	m_placed.clear();
+	const vec3i last_cell(int(dims[0]) - 2, int(dims[1]) - 2, int(dims[2]) - 2);
+	vec3i vox, cell;
+	for (size_t n : flipped) {
+		vox = vec3i(int(n % dims[0]), int((n / dims[0]) % dims[1]), int(n / (dims[0] * dims[1])));
+		for (int k = 0; k < 8; k++) {
+			cell = vox - vertex_offset[k];
+			if (cell.x < 0 || cell.y < 0 || cell.z < 0 || cell.x > last_cell.x || cell.y > last_cell.y || cell.z > last_cell.z) continue;
+			update_cell(cell, compute_cell_code(cell), delta);
+		}
+	}
+
+	// 3. the vertices of those cells are placed for the new isovalue, the others stay
+	place_vertices(delta);
+	if (m_free_slots * FREE_SLOTS > m_surface.nTriangles()) compact_triangles(delta);
+	else if (delta) {
+		// a slot freed and re-used by another cell is only listed as added
+		std::sort(delta->added.begin(), delta->added.end());
+		std::sort(delta->removed.begin(), delta->removed.end());
+		size_t kept = 0, k = 0;
+		for (int t : delta->removed) {
+			while (k < delta->added.size() && delta->added[k] < t) k++;
+			if (k == delta->added.size() || delta->added[k] != t) delta->removed[kept++] = t;
+		}
+		delta->removed.resize(kept);
+	}
+#ifndef NDEBUG
+	if (delta) {
+		// both lists are ascending now
+		const int n = int(m_surface.nTriangles());
+		for (size_t i = 0; i < delta->removed.size(); i++) {
+			assert("MarchingCubes::update() -- invalid removed slot" && delta->removed[i] < n && (i == 0 || delta->removed[i - 1] < delta->removed[i]));
+		}
+		for (size_t i = 0; i < delta->added.size(); i++) {
+			assert("MarchingCubes::update() -- invalid added slot" && delta->added[i] < n && (i == 0 || delta->added[i - 1] < delta->added[i]));
+		}
+	}
+#endif
+	printf("iso=%f, %zi flipped vertices, update took %.2fs\n", m_isovalue, flipped.size(), ct.query());
+	return m_surface;
+}
+
+const mesh& MarchingCubes::refresh(mesh_delta* delta) {
+	sync_view();
+	if (delta) delta->clear();
+	std::array<size_t, 3> dims = { m_vol.dimension(0), m_vol.dimension(1), m_vol.dimension(2) };
+	if (!m_surface_valid || m_surface_exact || dims != m_workspace_dims) return m_surface;
+	timer ct;
+	m_isovalue = m_surface_isovalue;
+	m_placed.clear();
+	for (int v = 0; v < int(m_vertex_edge.size()); v++) {
+		if (m_vertex_edge[v] != NO_EDGE) m_placed.push_back(v);
+	}
+	place_vertices(delta);
+	m_surface_exact = true;
+	printf("iso=%f, %zi vertices placed, refresh took %.2fs\n", m_isovalue, m_placed.size(), ct.query());
+	return m_surface;
+}
+
+const mesh& MarchingCubes::surface(void) const {
+	return m_surface;
+}
+
+void MarchingCubes::rebuild_surface(mesh_delta* delta) {
+	timer ct;
+	const int dimx = int(m_vol.dimension(0)), dimy = int(m_vol.dimension(1)), dimz = int(m_vol.dimension(2));
+	if (dimx < 2 || dimy < 2 || dimz < 2) {
+		// no cells, e.g. no volume loaded yet
+		m_surface.clear();
+		m_surface_valid = false;
+		return;
+	}
+	prepare_workspace();
+	m_lo = vec3i(0, 0, 0);
+	m_hi = vec3i(int(m_vol.dimension(0)) - 1, int(m_vol.dimension(1)) - 1, int(m_vol.dimension(2)) - 1);
+	m_planes.clear();
+	tag_vertices();
+	m_surface_isovalue = m_isovalue;
+	m_surface.clear();
+	m_surface_edges.clear();
+	m_surface_edges.reserve(m_last_vertices);
+	m_vertex_edge.clear();
+	m_free_vertices.clear();
+	for (auto& blocks : m_free_triangles) blocks.clear();
+	m_free_slots = 0;
+	m_triangle_cell.clear();
+	m_placed.clear();
+	m_cell_code.assign(m_vol.size(), 0);
+	m_cell_triangle.resize(m_vol.size());
+	vec3i cell;
+	for (cell.z = 0; cell.z < dimz - 1; cell.z++) {
+		for (cell.y = 0; cell.y < dimy - 1; cell.y++) {
+			cell_codes(cell.y, cell.z, 0, dimx - 1, m_worker[0].row_code.data(), m_worker[0].row_active.data());
+			// also cells with code 255 need their code stored, update_cell() skips the zeros
+			for (cell.x = 0; cell.x < dimx - 1; cell.x++) {
+				update_cell(cell, m_worker[0].row_code[cell.x], delta);
+			}
+		}
+	}
+	place_vertices(delta);
+	m_surface_valid = true;
+	m_surface_exact = true;
+	printf("iso=%f, %zi triangles, %zi vertices, rebuild took %.2fs\n", m_isovalue, m_surface.nTriangles(), m_surface.nVertices(), ct.query());
+}
+
+void MarchingCubes::update_cell(const vec3i& cell, uint8_t code, mesh_delta* delta) {
+	size_t a = linear_address(cell);
+	uint8_t old_code = m_cell_code[a];
+	if (code == old_code) return;
+	m_cell_code[a] = code;
+
+	// 1. remove the old triangles, their slots become a free block
+	const mc_case& c_old = mc_cases[old_code];
+	const mc_case& c_new = mc_cases[code];
+	if (c_old.nTriangles > 0) {
+		int first = m_cell_triangle[a];
+		for (int t = first; t < first + c_old.nTriangles; t++) {
+			vec3i& tri = m_surface.triangle(t);
+			tri = vec3i(tri.x, tri.x, tri.x);
+			if (delta) delta->removed.push_back(t);
+		}
+		m_free_triangles[c_old.nTriangles].push_back(first);
+		m_free_slots += c_old.nTriangles;
+	}
+
+	// 2. free the vertices of old edges that are no longer crossed by the surface.
+	//    All cells sharing such an edge have a flipped corner, so none of them keeps using it.
+	vec3i pos1, pos2;
+	for (int e = 0; e < c_old.nEdges; e++) {
+		const std::array<int8_t, 4>& E = mc_edge_offset[c_old.edge[e]];
+		pos1 = vec3i(cell.x + E[0], cell.y + E[1], cell.z + E[2]);
+		pos2 = pos1;
+		pos2[E[3]]++;
+		if (vertex_tag(pos1) != vertex_tag(pos2)) continue;
+		size_t id = edge_id(pos1, pos2);
+		int vertex = m_surface_edges.find(id);
+		if (vertex == -1) continue;
+		m_surface_edges.erase(id);
+		m_vertex_edge[vertex] = NO_EDGE;
+		m_free_vertices.push_back(vertex);
+	}
+
+	// 3. emit the new triangles into a free block of the right size, or append them
+	int nNew = c_new.nTriangles;
+	if (nNew == 0) return;
+	int first;
+	if (!m_free_triangles[nNew].empty()) {
+		first = m_free_triangles[nNew].back();
+		m_free_triangles[nNew].pop_back();
+		m_free_slots -= nNew;
+	}
+	else {
+		first = int(m_surface.nTriangles());
+		for (int t = 0; t < nNew; t++) m_surface.add_triangle(vec3i(0, 0, 0));
+		m_triangle_cell.resize(m_surface.nTriangles());
+	}
+	m_cell_triangle[a] = first;
+	for (int t = first; t < first + nNew; t++) m_triangle_cell[t] = a;
+	int cell_vertex[12];
+	for (int e = 0; e < c_new.nEdges; e++) {
+		const std::array<int8_t, 4>& E = mc_edge_offset[c_new.edge[e]];
+		pos1 = vec3i(cell.x + E[0], cell.y + E[1], cell.z + E[2]);
+		pos2 = pos1;
+		pos2[E[3]]++;
+		cell_vertex[e] = surface_vertex(pos1, pos2);
+		m_placed.push_back(cell_vertex[e]);
+	}
+	for (int t = 0; t < nNew; t++) {
+		vec3i triangle(cell_vertex[c_new.triangle[3 * t]], cell_vertex[c_new.triangle[3 * t + 1]], cell_vertex[c_new.triangle[3 * t + 2]]);
+		m_surface.triangle(first + t) = triangle;
+		if (delta) delta->added.push_back(first + t);
+	}
+}
+
+int MarchingCubes::surface_vertex(const vec3i& pos1, const vec3i& pos2) {
+	size_t id = edge_id(pos1, pos2);
+	int vertex = m_surface_edges.find(id);
+	if (vertex != -1) return vertex;
+	// the position is computed by place_vertices(), just claim a slot here
+	if (!m_free_vertices.empty()) {
+		vertex = m_free_vertices.back();
+		m_free_vertices.pop_back();
+		m_vertex_edge[vertex] = id;
+	}
+	else {
+		vertex = m_surface.add_vertex(vec3f(0.0f, 0.0f, 0.0f));
+		m_vertex_edge.push_back(id);
+	}
+	m_surface_edges.insert(id, vertex);
+	return vertex;
+}
+
+void MarchingCubes::place_vertices(mesh_delta* delta) {
+	edge_batch& B = m_worker[0].batch;
+	vec3f bias;
+	float scale;
+	vec3i pos1, pos2;
+	model_transform(bias, scale);
+	// a vertex shared by several changed cells was collected once per cell
+	std::sort(m_placed.begin(), m_placed.end());
+	m_placed.erase(std::unique(m_placed.begin(), m_placed.end()), m_placed.end());
+	for (int v : m_placed) {
+		// update_cell() may have freed it again after another cell collected it
+		if (m_vertex_edge[v] == NO_EDGE) continue;
+		edge_ends(m_vertex_edge[v], pos1, pos2);
+		gather_edge(B, pos1, int(m_vertex_edge[v] / m_vol.size()), v);
+		if (B.size >= edge_batch::FLUSH) interpolate_edges(B, bias, scale, m_surface);
+		if (delta) delta->vertices.push_back(v);
+	}
+	interpolate_edges(B, bias, scale, m_surface);
+}
+
+void MarchingCubes::compact_triangles(mesh_delta* delta) {
+	// the blocks keep their order, so the triangles of a cell stay consecutive
+	const int n = int(m_surface.nTriangles());
+	std::vector<uint8_t> fresh;							// slots delta already lists as added
+	if (delta) {
+		fresh.assign(size_t(n), 0);
+		for (int t : delta->added) fresh[t] = 1;
+		// no free slot is left, so nothing below the new end is removed, and
+		// a slot changed iff it received a moved or a new triangle
+		delta->added.clear();
+		delta->removed.clear();
+	}
+	int next = 0;
+	for (int t = 0; t < n; t++) {
+		const vec3i tri = m_surface.triangle(t);
+		if (tri.x == tri.y && tri.x == tri.z) continue;	// free slot
+		const size_t a = m_triangle_cell[t];
+		if (m_cell_triangle[a] == t) m_cell_triangle[a] = next;
+		if (next != t) {
+			m_surface.triangle(next) = tri;
+			m_triangle_cell[next] = a;
+		}
+		if (delta && (next != t || fresh[t])) delta->added.push_back(next);
+		next++;
+	}
+	m_surface.resize(m_surface.nVertices(), size_t(next));
+	m_triangle_cell.resize(size_t(next));
+	for (auto& blocks : m_free_triangles) blocks.clear();
+	m_free_slots = 0;
+}
+
+void MarchingCubes::model_transform(vec3f& bias, float& scale) const {
+	if (m_field || m_sparse) {
+		// m_vol is a slab or box at m_vol.origin() of the grid of the field or sparse volume
+		scale = 2.0f / float(std::max(grid_dimension(0), std::max(grid_dimension(1), grid_dimension(2))));
+		const vec3i& o = m_vol.origin();
+		bias = vec3f(grid_dimension(0) * 0.5f - float(o.x), grid_dimension(1) * 0.5f - float(o.y), grid_dimension(2) * 0.5f - float(o.z));
+		return;
+	}
+	scale = 2.0f / float(std::max(m_vol.dimension(0), std::max(m_vol.dimension(1), m_vol.dimension(2))));
+	bias = vec3f(m_vol.dimension(0) * 0.5f, m_vol.dimension(1) * 0.5f, m_vol.dimension(2) * 0.5f);
 }
 
 void MarchingCubes::tag_vertices(void) {
 	// TASK 2a: For each voxel in m_vol, set a tag {PLUS, MINUS} in m_vertex_tag.
 	//          Set it to PLUS for m_vol[n]>m_isovalue, otherwise to MINUS.
-	//		    Don't forget to resize m_vertex_tag first.
-	m_vertex_tag.resize(m_vol.size());
-	for (size_t n = 0; n < m_vol.size(); n++) {
-		if (m_vol[n] > m_isovalue) m_vertex_tag[n] = PLUS;
-		else m_vertex_tag[n] = MINUS;
+	//		    m_vertex_tag has been sized by prepare_workspace().
+	// One task per z-slice on the pool: worker w tags the w-th block of slices,
+	// the same block numa_for_slabs() used to first touch the volume.
+	// Only the voxels of the region, the other tags are left as they are.
+	pool().run(size_t(m_hi.z - m_lo.z + 1), [&](size_t task, int) { tag_slice(m_lo.z + int(task)); });
+}
+
+void MarchingCubes::tag_slice(int z) {
+	const ptrdiff_t sx = m_vol.stride(0);
+	for (int y = m_lo.y; y <= m_hi.y; y++) {
+		const size_t row = linear_address(vec3i(0, y, z));
+		const float* v = m_vol.data() + m_vol.address(0, y, z);
+		for (int x = m_lo.x; x <= m_hi.x; x++) {
+			if (v[ptrdiff_t(x) * sx] > m_isovalue) m_vertex_tag[row + x] = PLUS;
+			else m_vertex_tag[row + x] = MINUS;
+		}
+	}
+}
+
+void MarchingCubes::retag_vertices(float old_isovalue) {
+	// exactly the voxels with a value in (min(old,new), max(old,new)] change their tag
+	m_flipped.clear();
+	auto flip = [this](size_t n) {
+		m_vertex_tag[n] = m_vertex_tag[n] == PLUS ? MINUS : PLUS;
+		m_flipped.push_back(n);
+	};
+	float lo = std::min(old_isovalue, m_isovalue);
+	float hi = std::max(old_isovalue, m_isovalue);
+	if (m_vol.for_each_between(lo, hi, flip)) return;
+	// no index, scan everything
+	size_t n = 0;
+	for (int z = 0; z < int(m_vol.dimension(2)); z++) {
+		for (int y = 0; y < int(m_vol.dimension(1)); y++) {
+			const float* v = m_vol.data() + m_vol.address(0, y, z);
+			for (int x = 0; x < int(m_vol.dimension(0)); x++, n++) {
+				const float value = v[ptrdiff_t(x) * m_vol.stride(0)];
+				if (value > lo && value <= hi) flip(n);
+			}
+		}
 	}
 }
 
@@ -112,20 +1266,24 @@ vec3f MarchingCubes::grid_normal(const vec3i& vox) const {
 	//           Otherwise, compute forward or backward differences.
 	//			 Don't forget to normalize the gradient.
 	//           AND REMEMBER THAT THE NEGATIVE GRADIENT IS OFTEN THE SURFACE NORMAL!
-	vec3i voxR = vox;
-	vec3i voxL = vox;
+	// Same as stepping to the neighbor voxels voxL and voxR along each axis,
+	// but with the strides of the view. Dividing by the number of steps taken
+	// gives the centered, forward or backward difference.
+	const float* v = m_vol.data();
+	const ptrdiff_t n = m_vol.address(vox.x, vox.y, vox.z);
 	vec3f gradient;
 	for (int i = 0; i < 3; i++) {
-		voxR = vox;
-		voxL = vox;
+		ptrdiff_t L = n, R = n;
+		float steps = 0.0f;
 		if (vox[i] > 0) { // Left neighbor detected
-			voxL[i] = voxL[i] - 1;
+			L -= m_vol.stride(i);
+			steps += 1.0f;
 		}
-
-		if (vox[i] < (m_vol.dimension(i) - 1)) { // Right neighbor detected
-			voxR[i] = voxR[i] + 1;
+		if (vox[i] < int(m_vol.dimension(i)) - 1) { // Right neighbor detected
+			R += m_vol.stride(i);
+			steps += 1.0f;
 		}
-		gradient[i] = (m_vol(voxR) - m_vol(voxL)) / (voxR - voxL).length();
+		gradient[i] = steps > 0.0f ? (v[R] - v[L]) / steps : 0.0f;
 	}
 
 	return -(gradient.normalized());
@@ -163,6 +1321,246 @@ void MarchingCubes::edge_vertex(const vec3i& pos1, const vec3i& pos2, vec3f& pos
 	return;
 }
 
+void MarchingCubes::gather_edge(edge_batch& B, const vec3i& pos1, int axis, int vertex) const {
+	if (B.size == B.vertex.size()) {
+		size_t capacity = std::max(2 * B.size, edge_batch::FLUSH + edge_batch::LANES);
+		for (auto& c : B.data) c.resize(capacity, 0.0f);
+		B.vertex.resize(capacity, -1);
+	}
+	const size_t k = B.size++;
+	const float* v = m_vol.data();
+	vec3i pos2 = pos1;
+	pos2[axis]++;
+	const vec3i* end[2] = { &pos1, &pos2 };
+	for (int j = 0; j < 2; j++) {
+		const vec3i& p = *end[j];
+		const ptrdiff_t n = m_vol.address(p.x, p.y, p.z);
+		B.data[edge_batch::X1 + 3 * j][k] = float(p.x);
+		B.data[edge_batch::Y1 + 3 * j][k] = float(p.y);
+		B.data[edge_batch::Z1 + 3 * j][k] = float(p.z);
+		B.data[edge_batch::VALUE1 + j][k] = v[n];
+		// the neighbors grid_normal() would use
+		for (int i = 0; i < 3; i++) {
+			ptrdiff_t L = n, R = n;
+			float steps = 0.0f;
+			if (p[i] > 0) {
+				L -= m_vol.stride(i);
+				steps += 1.0f;
+			}
+			if (p[i] < int(m_vol.dimension(i)) - 1) {
+				R += m_vol.stride(i);
+				steps += 1.0f;
+			}
+			B.data[edge_batch::DIFF1 + 6 * j + i][k] = v[R] - v[L];
+			B.data[edge_batch::STEPS1 + 6 * j + i][k] = steps;
+		}
+	}
+	B.vertex[k] = vertex;
+}
+
+// Inputs of the vertex kernels below, one array entry per edge.
+// The kernels do the same arithmetic as edge_vertex(), with the gradients of
+// grid_normal() and the normalizations of vec3f written out per component,
+// and write position, normal and color of vertex[k]. Each one handles as many
+// edges as fit its registers and leaves the rest to the next narrower one.
+struct vertex_kernel_args {
+	const float* pos1[3];
+	const float* pos2[3];
+	const float* value1;
+	const float* value2;
+	const float* diff[2][3];
+	const float* steps[2][3];
+	const int* vertex;
+	size_t n;
+	float isovalue, scale;
+	vec3f bias;
+	mesh* M;
+};
+
+static void store_vertices(const vertex_kernel_args& A, size_t k, int lanes, const float* out) {
+	// out: 9 rows (position, normal, color) of lanes floats
+	for (int l = 0; l < lanes; l++) {
+		int v = A.vertex[k + l];
+		A.M->position(v) = vec3f(out[0 * lanes + l], out[1 * lanes + l], out[2 * lanes + l]);
+		A.M->normal(v) = vec3f(out[3 * lanes + l], out[4 * lanes + l], out[5 * lanes + l]);
+		A.M->color(v) = vec3f(out[6 * lanes + l], out[7 * lanes + l], out[8 * lanes + l]);
+	}
+}
+
+static void vertex_kernel_scalar(const vertex_kernel_args& A, size_t k) {
+	for (; k < A.n; k++) {
+		float a = (A.isovalue - A.value1[k]) / (A.value2[k] - A.value1[k]);
+		vec3f n[2];
+		for (int j = 0; j < 2; j++) {
+			vec3f g;
+			for (int i = 0; i < 3; i++) {
+				float steps = A.steps[j][i][k];
+				g[i] = steps > 0.0f ? A.diff[j][i][k] / steps : 0.0f;
+			}
+			float len2 = g[0] * g[0] + g[1] * g[1] + g[2] * g[2];
+			float inv = len2 > 0.0f ? 1.0f / std::sqrt(len2) : 0.0f;
+			for (int i = 0; i < 3; i++) n[j][i] = 0.0f - g[i] * inv;
+		}
+		vec3f P, N;
+		for (int i = 0; i < 3; i++) {
+			P[i] = A.pos1[i][k] + a * (A.pos2[i][k] - A.pos1[i][k]);
+			N[i] = n[0][i] + a * (n[1][i] - n[0][i]);
+		}
+		float len2 = N[0] * N[0] + N[1] * N[1] + N[2] * N[2];
+		float inv = len2 > 0.0f ? 1.0f / std::sqrt(len2) : 1.0f;
+		int v = A.vertex[k];
+		for (int i = 0; i < 3; i++) {
+			N[i] *= inv;
+			A.M->position(v)[i] = (P[i] - A.bias[i]) * A.scale;
+			A.M->normal(v)[i] = N[i];
+			A.M->color(v)[i] = (N[i] + 1.0f) * 0.5f;
+		}
+	}
+}
+
+#ifdef SIMD_X86
+SIMD_TARGET("sse2") static void vertex_kernel_sse2(const vertex_kernel_args& A, size_t k) {
+	const __m128 iso = _mm_set1_ps(A.isovalue);
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f);
+	const __m128 scale = _mm_set1_ps(A.scale);
+	alignas(16) float out[9 * 4];
+	for (; k + 4 <= A.n; k += 4) {
+		__m128 v1 = _mm_loadu_ps(A.value1 + k);
+		__m128 a = _mm_div_ps(_mm_sub_ps(iso, v1), _mm_sub_ps(_mm_loadu_ps(A.value2 + k), v1));
+		__m128 n[2][3];
+		for (int j = 0; j < 2; j++) {
+			__m128 g[3];
+			for (int i = 0; i < 3; i++) {
+				__m128 steps = _mm_loadu_ps(A.steps[j][i] + k);
+				g[i] = _mm_and_ps(_mm_cmpgt_ps(steps, zero), _mm_div_ps(_mm_loadu_ps(A.diff[j][i] + k), steps));
+			}
+			__m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(g[0], g[0]), _mm_mul_ps(g[1], g[1])), _mm_mul_ps(g[2], g[2]));
+			__m128 inv = _mm_and_ps(_mm_cmpgt_ps(len2, zero), _mm_div_ps(one, _mm_sqrt_ps(len2)));
+			for (int i = 0; i < 3; i++) n[j][i] = _mm_sub_ps(zero, _mm_mul_ps(g[i], inv));
+		}
+		__m128 N[3];
+		for (int i = 0; i < 3; i++) N[i] = _mm_add_ps(n[0][i], _mm_mul_ps(a, _mm_sub_ps(n[1][i], n[0][i])));
+		__m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(N[0], N[0]), _mm_mul_ps(N[1], N[1])), _mm_mul_ps(N[2], N[2]));
+		__m128 positive = _mm_cmpgt_ps(len2, zero);
+		__m128 inv = _mm_or_ps(_mm_and_ps(positive, _mm_div_ps(one, _mm_sqrt_ps(len2))), _mm_andnot_ps(positive, one));
+		for (int i = 0; i < 3; i++) {
+			__m128 p1 = _mm_loadu_ps(A.pos1[i] + k);
+			__m128 P = _mm_add_ps(p1, _mm_mul_ps(a, _mm_sub_ps(_mm_loadu_ps(A.pos2[i] + k), p1)));
+			N[i] = _mm_mul_ps(N[i], inv);
+			_mm_store_ps(out + 4 * i, _mm_mul_ps(_mm_sub_ps(P, _mm_set1_ps(A.bias[i])), scale));
+			_mm_store_ps(out + 4 * (3 + i), N[i]);
+			_mm_store_ps(out + 4 * (6 + i), _mm_mul_ps(_mm_add_ps(N[i], one), half));
+		}
+		store_vertices(A, k, 4, out);
+	}
+	vertex_kernel_scalar(A, k);
+}
+
+SIMD_TARGET("avx2") static void vertex_kernel_avx2(const vertex_kernel_args& A, size_t k) {
+	const __m256 iso = _mm256_set1_ps(A.isovalue);
+	const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), half = _mm256_set1_ps(0.5f);
+	const __m256 scale = _mm256_set1_ps(A.scale);
+	alignas(32) float out[9 * 8];
+	for (; k + 8 <= A.n; k += 8) {
+		__m256 v1 = _mm256_loadu_ps(A.value1 + k);
+		__m256 a = _mm256_div_ps(_mm256_sub_ps(iso, v1), _mm256_sub_ps(_mm256_loadu_ps(A.value2 + k), v1));
+		__m256 n[2][3];
+		for (int j = 0; j < 2; j++) {
+			__m256 g[3];
+			for (int i = 0; i < 3; i++) {
+				__m256 steps = _mm256_loadu_ps(A.steps[j][i] + k);
+				g[i] = _mm256_and_ps(_mm256_cmp_ps(steps, zero, _CMP_GT_OQ), _mm256_div_ps(_mm256_loadu_ps(A.diff[j][i] + k), steps));
+			}
+			__m256 len2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(g[0], g[0]), _mm256_mul_ps(g[1], g[1])), _mm256_mul_ps(g[2], g[2]));
+			__m256 inv = _mm256_and_ps(_mm256_cmp_ps(len2, zero, _CMP_GT_OQ), _mm256_div_ps(one, _mm256_sqrt_ps(len2)));
+			for (int i = 0; i < 3; i++) n[j][i] = _mm256_sub_ps(zero, _mm256_mul_ps(g[i], inv));
+		}
+		__m256 N[3];
+		for (int i = 0; i < 3; i++) N[i] = _mm256_add_ps(n[0][i], _mm256_mul_ps(a, _mm256_sub_ps(n[1][i], n[0][i])));
+		__m256 len2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(N[0], N[0]), _mm256_mul_ps(N[1], N[1])), _mm256_mul_ps(N[2], N[2]));
+		__m256 inv = _mm256_blendv_ps(one, _mm256_div_ps(one, _mm256_sqrt_ps(len2)), _mm256_cmp_ps(len2, zero, _CMP_GT_OQ));
+		for (int i = 0; i < 3; i++) {
+			__m256 p1 = _mm256_loadu_ps(A.pos1[i] + k);
+			__m256 P = _mm256_add_ps(p1, _mm256_mul_ps(a, _mm256_sub_ps(_mm256_loadu_ps(A.pos2[i] + k), p1)));
+			N[i] = _mm256_mul_ps(N[i], inv);
+			_mm256_store_ps(out + 8 * i, _mm256_mul_ps(_mm256_sub_ps(P, _mm256_set1_ps(A.bias[i])), scale));
+			_mm256_store_ps(out + 8 * (3 + i), N[i]);
+			_mm256_store_ps(out + 8 * (6 + i), _mm256_mul_ps(_mm256_add_ps(N[i], one), half));
+		}
+		store_vertices(A, k, 8, out);
+	}
+	vertex_kernel_sse2(A, k);
+}
+
+SIMD_TARGET("avx512f") static void vertex_kernel_avx512(const vertex_kernel_args& A, size_t k) {
+	const __m512 iso = _mm512_set1_ps(A.isovalue);
+	const __m512 zero = _mm512_setzero_ps(), one = _mm512_set1_ps(1.0f), half = _mm512_set1_ps(0.5f);
+	const __m512 scale = _mm512_set1_ps(A.scale);
+	alignas(64) float out[9 * 16];
+	for (; k + 16 <= A.n; k += 16) {
+		__m512 v1 = _mm512_loadu_ps(A.value1 + k);
+		__m512 a = _mm512_div_ps(_mm512_sub_ps(iso, v1), _mm512_sub_ps(_mm512_loadu_ps(A.value2 + k), v1));
+		__m512 n[2][3];
+		for (int j = 0; j < 2; j++) {
+			__m512 g[3];
+			for (int i = 0; i < 3; i++) {
+				__m512 steps = _mm512_loadu_ps(A.steps[j][i] + k);
+				g[i] = _mm512_maskz_div_ps(_mm512_cmp_ps_mask(steps, zero, _CMP_GT_OQ), _mm512_loadu_ps(A.diff[j][i] + k), steps);
+			}
+			__m512 len2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(g[0], g[0]), _mm512_mul_ps(g[1], g[1])), _mm512_mul_ps(g[2], g[2]));
+			// _mm512_sqrt_ps() starts from an undefined register, which GCC warns about,
+			// the masked form takes 1 for the zero lengths instead
+			const __mmask16 valid = _mm512_cmp_ps_mask(len2, zero, _CMP_GT_OQ);
+			__m512 inv = _mm512_maskz_mov_ps(valid, _mm512_div_ps(one, _mm512_mask_sqrt_ps(one, valid, len2)));
+			for (int i = 0; i < 3; i++) n[j][i] = _mm512_sub_ps(zero, _mm512_mul_ps(g[i], inv));
+		}
+		__m512 N[3];
+		for (int i = 0; i < 3; i++) N[i] = _mm512_add_ps(n[0][i], _mm512_mul_ps(a, _mm512_sub_ps(n[1][i], n[0][i])));
+		__m512 len2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(N[0], N[0]), _mm512_mul_ps(N[1], N[1])), _mm512_mul_ps(N[2], N[2]));
+		__m512 inv = _mm512_div_ps(one, _mm512_mask_sqrt_ps(one, _mm512_cmp_ps_mask(len2, zero, _CMP_GT_OQ), len2));
+		for (int i = 0; i < 3; i++) {
+			__m512 p1 = _mm512_loadu_ps(A.pos1[i] + k);
+			__m512 P = _mm512_add_ps(p1, _mm512_mul_ps(a, _mm512_sub_ps(_mm512_loadu_ps(A.pos2[i] + k), p1)));
+			N[i] = _mm512_mul_ps(N[i], inv);
+			_mm512_store_ps(out + 16 * i, _mm512_mul_ps(_mm512_sub_ps(P, _mm512_set1_ps(A.bias[i])), scale));
+			_mm512_store_ps(out + 16 * (3 + i), N[i]);
+			_mm512_store_ps(out + 16 * (6 + i), _mm512_mul_ps(_mm512_add_ps(N[i], one), half));
+		}
+		store_vertices(A, k, 16, out);
+	}
+	vertex_kernel_avx2(A, k);
+}
+#endif
+
+void MarchingCubes::interpolate_edges(edge_batch& B, const vec3f& bias, float scale, mesh& M) const {
+	vertex_kernel_args A;
+	for (int i = 0; i < 3; i++) {
+		A.pos1[i] = B.data[edge_batch::X1 + i].data();
+		A.pos2[i] = B.data[edge_batch::X2 + i].data();
+		for (int j = 0; j < 2; j++) {
+			A.diff[j][i] = B.data[edge_batch::DIFF1 + 6 * j + i].data();
+			A.steps[j][i] = B.data[edge_batch::STEPS1 + 6 * j + i].data();
+		}
+	}
+	A.value1 = B.data[edge_batch::VALUE1].data();
+	A.value2 = B.data[edge_batch::VALUE2].data();
+	A.vertex = B.vertex.data();
+	A.n = B.size;
+	A.isovalue = m_isovalue;
+	A.scale = scale;
+	A.bias = bias;
+	A.M = &M;
+	switch (m_simd) {
+#ifdef SIMD_X86
+	case SIMD_AVX512: vertex_kernel_avx512(A, 0); break;
+	case SIMD_AVX2: vertex_kernel_avx2(A, 0); break;
+	case SIMD_SSE2: vertex_kernel_sse2(A, 0); break;
+#endif
+	default: vertex_kernel_scalar(A, 0); break;
+	}
+	B.size = 0;
+}
+
 uint8_t MarchingCubes::compute_cell_code(const vec3i& vox) const {
 	// TASK 2d. Compute the cell code. For the table to work, use the 
 	//			corner offsets in vertex_offset, e.g., the sample position
@@ -181,6 +1579,241 @@ uint8_t MarchingCubes::compute_cell_code(const vec3i& vox) const {
 }
 
 
+// Cube codes of the cells x..n-1 of a row from the four tag rows that bound it:
+// r[0] = (y,z), r[1] = (y+1,z), r[2] = (y,z+1), r[3] = (y+1,z+1), each n+1 tags long.
+// Writes the codes to code and appends the indices of the active cells (code
+// not 0 or 255) to active, which holds nActive entries already.
+// RETURNS the number of active cells. Bit i of a code is the tag of corner
+// mc_corner[i], the tags are 0 or 1, so shifting 16 bit lanes never moves a
+// bit into the neighboring byte. Like the vertex kernels, each one handles
+// as many cells as fit its registers and leaves the rest to the next one.
+static int cell_code_kernel_scalar(const uint8_t* const r[4], int x, int n, uint8_t* code, int* active, int nActive) {
+	for (; x < n; x++) {
+		uint8_t c = uint8_t(r[2][x] | (r[2][x + 1] << 1) | (r[0][x + 1] << 2) | (r[0][x] << 3)
+			| (r[3][x] << 4) | (r[3][x + 1] << 5) | (r[1][x + 1] << 6) | (r[1][x] << 7));
+		code[x] = c;
+		if (c != 0 && c != 255) active[nActive++] = x;
+	}
+	return nActive;
+}
+
+static inline int append_active(uint64_t mask, int x, int* active, int nActive) {
+	// one iteration per set bit, clearing the lowest one each time
+	for (; mask != 0; mask &= mask - 1) active[nActive++] = x + simd_ctz(mask);
+	return nActive;
+}
+
+#ifdef SIMD_X86
+SIMD_TARGET("sse2") static int cell_code_kernel_sse2(const uint8_t* const r[4], int x, int n, uint8_t* code, int* active, int nActive) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi8(char(0xFF));
+	for (; x + 16 <= n; x += 16) {
+		__m128i c = _mm_loadu_si128((const __m128i*)(r[2] + x));
+		c = _mm_or_si128(c, _mm_slli_epi16(_mm_loadu_si128((const __m128i*)(r[2] + x + 1)), 1));
+		c = _mm_or_si128(c, _mm_slli_epi16(_mm_loadu_si128((const __m128i*)(r[0] + x + 1)), 2));
+		c = _mm_or_si128(c, _mm_slli_epi16(_mm_loadu_si128((const __m128i*)(r[0] + x)), 3));
+		c = _mm_or_si128(c, _mm_slli_epi16(_mm_loadu_si128((const __m128i*)(r[3] + x)), 4));
+		c = _mm_or_si128(c, _mm_slli_epi16(_mm_loadu_si128((const __m128i*)(r[3] + x + 1)), 5));
+		c = _mm_or_si128(c, _mm_slli_epi16(_mm_loadu_si128((const __m128i*)(r[1] + x + 1)), 6));
+		c = _mm_or_si128(c, _mm_slli_epi16(_mm_loadu_si128((const __m128i*)(r[1] + x)), 7));
+		_mm_storeu_si128((__m128i*)(code + x), c);
+		unsigned inactive = unsigned(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(c, zero), _mm_cmpeq_epi8(c, full))));
+		nActive = append_active(~inactive & 0xFFFFu, x, active, nActive);
+	}
+	return cell_code_kernel_scalar(r, x, n, code, active, nActive);
+}
+
+SIMD_TARGET("avx2") static int cell_code_kernel_avx2(const uint8_t* const r[4], int x, int n, uint8_t* code, int* active, int nActive) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i full = _mm256_set1_epi8(char(0xFF));
+	for (; x + 32 <= n; x += 32) {
+		__m256i c = _mm256_loadu_si256((const __m256i*)(r[2] + x));
+		c = _mm256_or_si256(c, _mm256_slli_epi16(_mm256_loadu_si256((const __m256i*)(r[2] + x + 1)), 1));
+		c = _mm256_or_si256(c, _mm256_slli_epi16(_mm256_loadu_si256((const __m256i*)(r[0] + x + 1)), 2));
+		c = _mm256_or_si256(c, _mm256_slli_epi16(_mm256_loadu_si256((const __m256i*)(r[0] + x)), 3));
+		c = _mm256_or_si256(c, _mm256_slli_epi16(_mm256_loadu_si256((const __m256i*)(r[3] + x)), 4));
+		c = _mm256_or_si256(c, _mm256_slli_epi16(_mm256_loadu_si256((const __m256i*)(r[3] + x + 1)), 5));
+		c = _mm256_or_si256(c, _mm256_slli_epi16(_mm256_loadu_si256((const __m256i*)(r[1] + x + 1)), 6));
+		c = _mm256_or_si256(c, _mm256_slli_epi16(_mm256_loadu_si256((const __m256i*)(r[1] + x)), 7));
+		_mm256_storeu_si256((__m256i*)(code + x), c);
+		unsigned inactive = unsigned(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(c, zero), _mm256_cmpeq_epi8(c, full))));
+		nActive = append_active(~inactive & 0xFFFFFFFFu, x, active, nActive);
+	}
+	return cell_code_kernel_sse2(r, x, n, code, active, nActive);
+}
+
+SIMD_TARGET("avx512f,avx512bw") static int cell_code_kernel_avx512(const uint8_t* const r[4], int x, int n, uint8_t* code, int* active, int nActive) {
+	const __m512i zero = _mm512_setzero_si512();
+	const __m512i full = _mm512_set1_epi8(char(0xFF));
+	for (; x + 64 <= n; x += 64) {
+		__m512i c = _mm512_loadu_si512(r[2] + x);
+		c = _mm512_or_si512(c, _mm512_slli_epi16(_mm512_loadu_si512(r[2] + x + 1), 1));
+		c = _mm512_or_si512(c, _mm512_slli_epi16(_mm512_loadu_si512(r[0] + x + 1), 2));
+		c = _mm512_or_si512(c, _mm512_slli_epi16(_mm512_loadu_si512(r[0] + x), 3));
+		c = _mm512_or_si512(c, _mm512_slli_epi16(_mm512_loadu_si512(r[3] + x), 4));
+		c = _mm512_or_si512(c, _mm512_slli_epi16(_mm512_loadu_si512(r[3] + x + 1), 5));
+		c = _mm512_or_si512(c, _mm512_slli_epi16(_mm512_loadu_si512(r[1] + x + 1), 6));
+		c = _mm512_or_si512(c, _mm512_slli_epi16(_mm512_loadu_si512(r[1] + x), 7));
+		_mm512_storeu_si512(code + x, c);
+		uint64_t inactive = uint64_t(_mm512_cmpeq_epi8_mask(c, zero)) | uint64_t(_mm512_cmpeq_epi8_mask(c, full));
+		nActive = append_active(~inactive, x, active, nActive);
+	}
+	return cell_code_kernel_avx2(r, x, n, code, active, nActive);
+}
+#endif
+
+bool MarchingCubes::clip_row(int y, int z, int& x0, int& x1) const {
+	// the planes are in the grid of the field or sparse volume, not of the slab or box
+	const vec3i o = m_field || m_sparse ? m_vol.origin() : vec3i(0, 0, 0);
+	y += o.y;
+	z += o.z;
+	x0 += o.x;
+	x1 += o.x;
+	for (const vec4f& p : m_planes) {
+		// the corner of a cell furthest along the plane normal decides, the
+		// cell at x is kept if a*x + k >= 0; the bound from the division is
+		// corrected by evaluating the condition itself
+		const float k = p.x * (p.x > 0.0f ? 1.0f : 0.0f) + p.y * (float(y) + (p.y > 0.0f ? 1.0f : 0.0f)) + p.z * (float(z) + (p.z > 0.0f ? 1.0f : 0.0f)) + p.w;
+		auto kept = [&](int x) { return p.x * float(x) + k >= 0.0f; };
+		if (p.x > 0.0f) {
+			float bound = std::ceil(-k / p.x);
+			int first = bound > float(x0) ? (bound < float(x1) ? int(bound) : x1) : x0;
+			while (first > x0 && kept(first - 1)) first--;
+			while (first < x1 && !kept(first)) first++;
+			x0 = first;
+		}
+		else if (p.x < 0.0f) {
+			float bound = std::floor(-k / p.x) + 1.0f;
+			int end = bound > float(x0) ? (bound < float(x1) ? int(bound) : x1) : x0;
+			while (end < x1 && kept(end)) end++;
+			while (end > x0 && !kept(end - 1)) end--;
+			x1 = end;
+		}
+		else if (!(k >= 0.0f)) x1 = x0;
+		if (x0 >= x1) break;
+	}
+	const bool any = m_planes.empty() || x0 < x1;
+	x0 -= o.x;
+	x1 -= o.x;
+	return any;
+}
+
+int MarchingCubes::cell_codes(int y, int z, int x0, int x1, uint8_t* code, int* active) const {
+	static_assert(PLUS == 1 && MINUS == 0, "the cell code kernels combine the tags as bits");
+	assert("MarchingCubes::cell_codes() -- invalid argument(s)" && y >= 0 && z >= 0 && y + 1 < int(m_vol.dimension(1)) && z + 1 < int(m_vol.dimension(2))
+		&& x0 >= 0 && x0 <= x1 && x1 < int(m_vol.dimension(0)));
+	const size_t sy = m_vol.dimension(0), sz = m_vol.dimension(0) * m_vol.dimension(1);
+	const uint8_t* r00 = m_vertex_tag.data() + linear_address(vec3i(0, y, z));
+	const uint8_t* const r[4] = { r00, r00 + sy, r00 + sz, r00 + sy + sz };
+	switch (m_simd) {
+#ifdef SIMD_X86
+	case SIMD_AVX512: return cell_code_kernel_avx512(r, x0, x1, code, active, 0);
+	case SIMD_AVX2: return cell_code_kernel_avx2(r, x0, x1, code, active, 0);
+	case SIMD_SSE2: return cell_code_kernel_sse2(r, x0, x1, code, active, 0);
+#endif
+	default: return cell_code_kernel_scalar(r, x0, x1, code, active, 0);
+	}
+}
+
+// Tags of v[x] for x in 64*k..n-1 as bits, 64 per word; the bits past n in
+// the last word are 0. Like the cell code kernels, each one does the whole
+// words it can and leaves the rest to the next narrower one.
+static void tag_bits_kernel_scalar(const float* v, int n, float isovalue, uint64_t* bits, int k) {
+	for (; 64 * k < n; k++) {
+		uint64_t w = 0;
+		for (int i = 0; i < 64 && 64 * k + i < n; i++) w |= uint64_t(v[64 * k + i] > isovalue) << i;
+		bits[k] = w;
+	}
+}
+
+#ifdef SIMD_X86
+SIMD_TARGET("sse2") static void tag_bits_kernel_sse2(const float* v, int n, float isovalue, uint64_t* bits, int k) {
+	const __m128 iso = _mm_set1_ps(isovalue);
+	for (; 64 * k + 64 <= n; k++) {
+		uint64_t w = 0;
+		for (int j = 0; j < 16; j++) w |= uint64_t(_mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(v + 64 * k + 4 * j), iso))) << (4 * j);
+		bits[k] = w;
+	}
+	tag_bits_kernel_scalar(v, n, isovalue, bits, k);
+}
+
+SIMD_TARGET("avx2") static void tag_bits_kernel_avx2(const float* v, int n, float isovalue, uint64_t* bits, int k) {
+	const __m256 iso = _mm256_set1_ps(isovalue);
+	for (; 64 * k + 64 <= n; k++) {
+		uint64_t w = 0;
+		for (int j = 0; j < 8; j++) w |= uint64_t(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(v + 64 * k + 8 * j), iso, _CMP_GT_OQ))) << (8 * j);
+		bits[k] = w;
+	}
+	tag_bits_kernel_sse2(v, n, isovalue, bits, k);
+}
+
+SIMD_TARGET("avx512f") static void tag_bits_kernel_avx512(const float* v, int n, float isovalue, uint64_t* bits, int k) {
+	const __m512 iso = _mm512_set1_ps(isovalue);
+	for (; 64 * k + 64 <= n; k++) {
+		uint64_t w = 0;
+		for (int j = 0; j < 4; j++) w |= uint64_t(_mm512_cmp_ps_mask(_mm512_loadu_ps(v + 64 * k + 16 * j), iso, _CMP_GT_OQ)) << (16 * j);
+		bits[k] = w;
+	}
+	tag_bits_kernel_avx2(v, n, isovalue, bits, k);
+}
+#endif
+
+void MarchingCubes::tag_bits(const float* v, int n, float isovalue, uint64_t* bits) const {
+	switch (m_simd) {
+#ifdef SIMD_X86
+	case SIMD_AVX512: return tag_bits_kernel_avx512(v, n, isovalue, bits, 0);
+	case SIMD_AVX2: return tag_bits_kernel_avx2(v, n, isovalue, bits, 0);
+	case SIMD_SSE2: return tag_bits_kernel_sse2(v, n, isovalue, bits, 0);
+#endif
+	default: return tag_bits_kernel_scalar(v, n, isovalue, bits, 0);
+	}
+}
+
+void MarchingCubes::set_simd(simd_level level) {
+	m_simd = std::min(level, simd_detect());
+}
+
+simd_level MarchingCubes::simd(void) const {
+	return m_simd;
+}
+
+void MarchingCubes::set_threads(int nThreads) {
+	m_threads = std::max(nThreads, 0);
+	// the pool is created with the new size on next use
+	if (m_pool && m_pool->size() != threads()) m_pool.reset();
+}
+
+void MarchingCubes::set_parallel_mode(parallel_mode mode) {
+	m_parallel_mode = mode;
+}
+
+MarchingCubes::parallel_mode MarchingCubes::parallel(void) const {
+	return m_parallel_mode;
+}
+
+int MarchingCubes::threads(void) const {
+	if (m_threads > 0) return std::min(m_threads, int(thread_pool::MAX_THREADS));
+	return std::min(std::max(int(std::thread::hardware_concurrency()), 1), int(thread_pool::MAX_THREADS));
+}
+
+const thread_pool& MarchingCubes::scheduler(void) {
+	return pool();
+}
+
+void MarchingCubes::set_pinning(bool pinned) {
+	if (m_pool && m_pool->pinned() != pinned) m_pool.reset();
+	m_pinned = pinned;
+}
+
+bool MarchingCubes::pinning(void) const {
+	return m_pinned;
+}
+
+thread_pool& MarchingCubes::pool(void) {
+	if (!m_pool) m_pool.reset(new thread_pool(threads(), m_pinned));
+	return *m_pool;
+}
+
 const vec3i MarchingCubes::DX(1, 0, 0);
 const vec3i MarchingCubes::DY(0, 1, 0);
 const vec3i MarchingCubes::DZ(0, 0, 1);
@@ -196,7 +1829,36 @@ const int MarchingCubes::edges[24]{
 	0,4, 1,5, 2,6, 3,7
 };
 
-MarchingCubes::MarchingCubes(const volume& V) : m_vol(V), m_isovalue(0.0f) {
+MarchingCubes::MarchingCubes(const volume& V) : m_volume(&V), m_vol(V.view()), m_field(nullptr), m_sparse(nullptr), m_isovalue(0.0f), m_lo(0, 0, 0), m_hi(0, 0, 0), m_workspace_dims({ 0,0,0 }), m_edge_map_mode(AUTO), m_last_vertices(0), m_last_triangles(0), m_simd(simd_detect()), m_threads(0), m_pinned(numa_nodes() > 1), m_parallel_mode(ORDERED), m_console(console_report, 1.0, false), m_next_chunk(0), m_surface_valid(false), m_surface_isovalue(0.0f), m_surface_exact(false), m_free_slots(0) {
+}
+
+MarchingCubes::MarchingCubes(const volume_view& V) : m_volume(nullptr), m_vol(V), m_field(nullptr), m_sparse(nullptr), m_isovalue(0.0f), m_lo(0, 0, 0), m_hi(0, 0, 0), m_workspace_dims({ 0,0,0 }), m_edge_map_mode(AUTO), m_last_vertices(0), m_last_triangles(0), m_simd(simd_detect()), m_threads(0), m_pinned(numa_nodes() > 1), m_parallel_mode(ORDERED), m_console(console_report, 1.0, false), m_next_chunk(0), m_surface_valid(false), m_surface_isovalue(0.0f), m_surface_exact(false), m_free_slots(0) {
+}
+
+MarchingCubes::MarchingCubes(const implicit_field& F) : m_volume(nullptr), m_field(&F), m_sparse(nullptr), m_isovalue(0.0f), m_lo(0, 0, 0), m_hi(0, 0, 0), m_workspace_dims({ 0,0,0 }), m_edge_map_mode(AUTO), m_last_vertices(0), m_last_triangles(0), m_simd(simd_detect()), m_threads(0), m_pinned(numa_nodes() > 1), m_parallel_mode(ORDERED), m_console(console_report, 1.0, false), m_next_chunk(0), m_surface_valid(false), m_surface_isovalue(0.0f), m_surface_exact(false), m_free_slots(0) {
+}
+
+MarchingCubes::MarchingCubes(const sparse_volume& S) : m_volume(nullptr), m_field(nullptr), m_sparse(&S), m_isovalue(0.0f), m_lo(0, 0, 0), m_hi(0, 0, 0), m_workspace_dims({ 0,0,0 }), m_edge_map_mode(AUTO), m_last_vertices(0), m_last_triangles(0), m_simd(simd_detect()), m_threads(0), m_pinned(numa_nodes() > 1), m_parallel_mode(ORDERED), m_console(console_report, 1.0, false), m_next_chunk(0), m_surface_valid(false), m_surface_isovalue(0.0f), m_surface_exact(false), m_free_slots(0) {
+}
+
+void MarchingCubes::console_report(const progress& P) {
+	printf("\r%.2f%% (%.2fs)", P.fraction() * 100.0f, P.elapsed());
+	fflush(stdout);
+}
+
+bool MarchingCubes::streamed(void) const {
+	return m_field != nullptr || m_sparse != nullptr;
+}
+
+size_t MarchingCubes::grid_dimension(size_t n) const {
+	if (m_field) return m_field->dimension(n);
+	if (m_sparse) return m_sparse->dimension(n);
+	return m_vol.dimension(n);
+}
+
+void MarchingCubes::sync_view(void) const {
+	// the volume may have been resized or replaced since the last call
+	if (m_volume) m_vol = m_volume->view();
 }
 
 MarchingCubes::~MarchingCubes(void) {
@@ -204,299 +1866,92 @@ MarchingCubes::~MarchingCubes(void) {
 }
 
 void MarchingCubes::clear(void) {
-	m_vertex_tag.clear();
-}
-
-const int MarchingCubes::edge_table[256] = {
-	0x0  , 0x109, 0x203, 0x30a, 0x406, 0x50f, 0x605, 0x70c,
-	0x80c, 0x905, 0xa0f, 0xb06, 0xc0a, 0xd03, 0xe09, 0xf00,
-	0x190, 0x99 , 0x393, 0x29a, 0x596, 0x49f, 0x795, 0x69c,
-	0x99c, 0x895, 0xb9f, 0xa96, 0xd9a, 0xc93, 0xf99, 0xe90,
-	0x230, 0x339, 0x33 , 0x13a, 0x636, 0x73f, 0x435, 0x53c,
-	0xa3c, 0xb35, 0x83f, 0x936, 0xe3a, 0xf33, 0xc39, 0xd30,
-	0x3a0, 0x2a9, 0x1a3, 0xaa , 0x7a6, 0x6af, 0x5a5, 0x4ac,
-	0xbac, 0xaa5, 0x9af, 0x8a6, 0xfaa, 0xea3, 0xda9, 0xca0,
-	0x460, 0x569, 0x663, 0x76a, 0x66 , 0x16f, 0x265, 0x36c,
-	0xc6c, 0xd65, 0xe6f, 0xf66, 0x86a, 0x963, 0xa69, 0xb60,
-	0x5f0, 0x4f9, 0x7f3, 0x6fa, 0x1f6, 0xff , 0x3f5, 0x2fc,
-	0xdfc, 0xcf5, 0xfff, 0xef6, 0x9fa, 0x8f3, 0xbf9, 0xaf0,
-	0x650, 0x759, 0x453, 0x55a, 0x256, 0x35f, 0x55 , 0x15c,
-	0xe5c, 0xf55, 0xc5f, 0xd56, 0xa5a, 0xb53, 0x859, 0x950,
-	0x7c0, 0x6c9, 0x5c3, 0x4ca, 0x3c6, 0x2cf, 0x1c5, 0xcc ,
-	0xfcc, 0xec5, 0xdcf, 0xcc6, 0xbca, 0xac3, 0x9c9, 0x8c0,
-	0x8c0, 0x9c9, 0xac3, 0xbca, 0xcc6, 0xdcf, 0xec5, 0xfcc,
-	0xcc , 0x1c5, 0x2cf, 0x3c6, 0x4ca, 0x5c3, 0x6c9, 0x7c0,
-	0x950, 0x859, 0xb53, 0xa5a, 0xd56, 0xc5f, 0xf55, 0xe5c,
-	0x15c, 0x55 , 0x35f, 0x256, 0x55a, 0x453, 0x759, 0x650,
-	0xaf0, 0xbf9, 0x8f3, 0x9fa, 0xef6, 0xfff, 0xcf5, 0xdfc,
-	0x2fc, 0x3f5, 0xff , 0x1f6, 0x6fa, 0x7f3, 0x4f9, 0x5f0,
-	0xb60, 0xa69, 0x963, 0x86a, 0xf66, 0xe6f, 0xd65, 0xc6c,
-	0x36c, 0x265, 0x16f, 0x66 , 0x76a, 0x663, 0x569, 0x460,
-	0xca0, 0xda9, 0xea3, 0xfaa, 0x8a6, 0x9af, 0xaa5, 0xbac,
-	0x4ac, 0x5a5, 0x6af, 0x7a6, 0xaa , 0x1a3, 0x2a9, 0x3a0,
-	0xd30, 0xc39, 0xf33, 0xe3a, 0x936, 0x83f, 0xb35, 0xa3c,
-	0x53c, 0x435, 0x73f, 0x636, 0x13a, 0x33 , 0x339, 0x230,
-	0xe90, 0xf99, 0xc93, 0xd9a, 0xa96, 0xb9f, 0x895, 0x99c,
-	0x69c, 0x795, 0x49f, 0x596, 0x29a, 0x393, 0x99 , 0x190,
-	0xf00, 0xe09, 0xd03, 0xc0a, 0xb06, 0xa0f, 0x905, 0x80c,
-	0x70c, 0x605, 0x50f, 0x406, 0x30a, 0x203, 0x109, 0x0
-};
+	// swap with an empty vector, clear() alone would keep the capacity
+	decltype(m_vertex_tag)().swap(m_vertex_tag);
+	std::vector<worker_space>().swap(m_worker);
+	std::vector<brick>().swap(m_bricks);
+	std::vector<int>().swap(m_stitch);
+	m_concurrent_edges.release();
+	m_chunks = mesh();
+	std::vector<size_t>().swap(m_chunk_fill);
+	m_arena.release();
+	m_dense_edges.release();
+	m_sparse_edges.release();
+	m_workspace_dims = { 0,0,0 };
+	m_last_vertices = m_last_triangles = 0;
+	m_surface.clear();
+	m_surface_valid = false;
+	decltype(m_cell_code)().swap(m_cell_code);
+	std::vector<int>().swap(m_cell_triangle);
+	std::vector<size_t>().swap(m_triangle_cell);
+	std::vector<int>().swap(m_placed);
+	std::vector<size_t>().swap(m_vertex_edge);
+	std::vector<int>().swap(m_free_vertices);
+	std::vector<size_t>().swap(m_flipped);
+	for (auto& blocks : m_free_triangles) std::vector<int>().swap(blocks);
+	m_free_slots = 0;
+	m_surface_edges.release();
+	std::vector<vec3i>().swap(m_front);
+	decltype(m_seen_cells)().swap(m_seen_cells);
+	decltype(m_field_slab)().swap(m_field_slab);
+	m_field_edges.release();
+}
+
+void MarchingCubes::set_edge_map(edge_map_mode mode) {
+	m_edge_map_mode = mode;
+}
+
+MarchingCubes::edge_map_mode MarchingCubes::edge_map(void) const {
+	if (m_edge_map_mode != AUTO) return m_edge_map_mode;
+	sync_view();
+	return 3 * m_vol.size() * sizeof(int) <= DENSE_EDGE_MAP_LIMIT ? DENSE : SPARSE;
+}
 
-const int MarchingCubes::triTable[256][16] = {
-	{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{0, 1, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{1, 8, 3, 9, 8, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{1, 2, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{0, 8, 3, 1, 2, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{9, 2, 10, 0, 2, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{2, 8, 3, 2, 10, 8, 10, 9, 8, -1, -1, -1, -1, -1, -1, -1},
-	{3, 11, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{0, 11, 2, 8, 11, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{1, 9, 0, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{1, 11, 2, 1, 9, 11, 9, 8, 11, -1, -1, -1, -1, -1, -1, -1},
-	{3, 10, 1, 11, 10, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{0, 10, 1, 0, 8, 10, 8, 11, 10, -1, -1, -1, -1, -1, -1, -1},
-	{3, 9, 0, 3, 11, 9, 11, 10, 9, -1, -1, -1, -1, -1, -1, -1},
-	{9, 8, 10, 10, 8, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{4, 7, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{4, 3, 0, 7, 3, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{0, 1, 9, 8, 4, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{4, 1, 9, 4, 7, 1, 7, 3, 1, -1, -1, -1, -1, -1, -1, -1},
-	{1, 2, 10, 8, 4, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{3, 4, 7, 3, 0, 4, 1, 2, 10, -1, -1, -1, -1, -1, -1, -1},
-	{9, 2, 10, 9, 0, 2, 8, 4, 7, -1, -1, -1, -1, -1, -1, -1},
-	{2, 10, 9, 2, 9, 7, 2, 7, 3, 7, 9, 4, -1, -1, -1, -1},
-	{8, 4, 7, 3, 11, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{11, 4, 7, 11, 2, 4, 2, 0, 4, -1, -1, -1, -1, -1, -1, -1},
-	{9, 0, 1, 8, 4, 7, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1},
-	{4, 7, 11, 9, 4, 11, 9, 11, 2, 9, 2, 1, -1, -1, -1, -1},
-	{3, 10, 1, 3, 11, 10, 7, 8, 4, -1, -1, -1, -1, -1, -1, -1},
-	{1, 11, 10, 1, 4, 11, 1, 0, 4, 7, 11, 4, -1, -1, -1, -1},
-	{4, 7, 8, 9, 0, 11, 9, 11, 10, 11, 0, 3, -1, -1, -1, -1},
-	{4, 7, 11, 4, 11, 9, 9, 11, 10, -1, -1, -1, -1, -1, -1, -1},
-	{9, 5, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{9, 5, 4, 0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{0, 5, 4, 1, 5, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{8, 5, 4, 8, 3, 5, 3, 1, 5, -1, -1, -1, -1, -1, -1, -1},
-	{1, 2, 10, 9, 5, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{3, 0, 8, 1, 2, 10, 4, 9, 5, -1, -1, -1, -1, -1, -1, -1},
-	{5, 2, 10, 5, 4, 2, 4, 0, 2, -1, -1, -1, -1, -1, -1, -1},
-	{2, 10, 5, 3, 2, 5, 3, 5, 4, 3, 4, 8, -1, -1, -1, -1},
-	{9, 5, 4, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{0, 11, 2, 0, 8, 11, 4, 9, 5, -1, -1, -1, -1, -1, -1, -1},
-	{0, 5, 4, 0, 1, 5, 2, 3, 11, -1, -1, -1, -1, -1, -1, -1},
-	{2, 1, 5, 2, 5, 8, 2, 8, 11, 4, 8, 5, -1, -1, -1, -1},
-	{10, 3, 11, 10, 1, 3, 9, 5, 4, -1, -1, -1, -1, -1, -1, -1},
-	{4, 9, 5, 0, 8, 1, 8, 10, 1, 8, 11, 10, -1, -1, -1, -1},
-	{5, 4, 0, 5, 0, 11, 5, 11, 10, 11, 0, 3, -1, -1, -1, -1},
-	{5, 4, 8, 5, 8, 10, 10, 8, 11, -1, -1, -1, -1, -1, -1, -1},
-	{9, 7, 8, 5, 7, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{9, 3, 0, 9, 5, 3, 5, 7, 3, -1, -1, -1, -1, -1, -1, -1},
-	{0, 7, 8, 0, 1, 7, 1, 5, 7, -1, -1, -1, -1, -1, -1, -1},
-	{1, 5, 3, 3, 5, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{9, 7, 8, 9, 5, 7, 10, 1, 2, -1, -1, -1, -1, -1, -1, -1},
-	{10, 1, 2, 9, 5, 0, 5, 3, 0, 5, 7, 3, -1, -1, -1, -1},
-	{8, 0, 2, 8, 2, 5, 8, 5, 7, 10, 5, 2, -1, -1, -1, -1},
-	{2, 10, 5, 2, 5, 3, 3, 5, 7, -1, -1, -1, -1, -1, -1, -1},
-	{7, 9, 5, 7, 8, 9, 3, 11, 2, -1, -1, -1, -1, -1, -1, -1},
-	{9, 5, 7, 9, 7, 2, 9, 2, 0, 2, 7, 11, -1, -1, -1, -1},
-	{2, 3, 11, 0, 1, 8, 1, 7, 8, 1, 5, 7, -1, -1, -1, -1},
-	{11, 2, 1, 11, 1, 7, 7, 1, 5, -1, -1, -1, -1, -1, -1, -1},
-	{9, 5, 8, 8, 5, 7, 10, 1, 3, 10, 3, 11, -1, -1, -1, -1},
-	{5, 7, 0, 5, 0, 9, 7, 11, 0, 1, 0, 10, 11, 10, 0, -1},
-	{11, 10, 0, 11, 0, 3, 10, 5, 0, 8, 0, 7, 5, 7, 0, -1},
-	{11, 10, 5, 7, 11, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{10, 6, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{0, 8, 3, 5, 10, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{9, 0, 1, 5, 10, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{1, 8, 3, 1, 9, 8, 5, 10, 6, -1, -1, -1, -1, -1, -1, -1},
-	{1, 6, 5, 2, 6, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{1, 6, 5, 1, 2, 6, 3, 0, 8, -1, -1, -1, -1, -1, -1, -1},
-	{9, 6, 5, 9, 0, 6, 0, 2, 6, -1, -1, -1, -1, -1, -1, -1},
-	{5, 9, 8, 5, 8, 2, 5, 2, 6, 3, 2, 8, -1, -1, -1, -1},
-	{2, 3, 11, 10, 6, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{11, 0, 8, 11, 2, 0, 10, 6, 5, -1, -1, -1, -1, -1, -1, -1},
-	{0, 1, 9, 2, 3, 11, 5, 10, 6, -1, -1, -1, -1, -1, -1, -1},
-	{5, 10, 6, 1, 9, 2, 9, 11, 2, 9, 8, 11, -1, -1, -1, -1},
-	{6, 3, 11, 6, 5, 3, 5, 1, 3, -1, -1, -1, -1, -1, -1, -1},
-	{0, 8, 11, 0, 11, 5, 0, 5, 1, 5, 11, 6, -1, -1, -1, -1},
-	{3, 11, 6, 0, 3, 6, 0, 6, 5, 0, 5, 9, -1, -1, -1, -1},
-	{6, 5, 9, 6, 9, 11, 11, 9, 8, -1, -1, -1, -1, -1, -1, -1},
-	{5, 10, 6, 4, 7, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{4, 3, 0, 4, 7, 3, 6, 5, 10, -1, -1, -1, -1, -1, -1, -1},
-	{1, 9, 0, 5, 10, 6, 8, 4, 7, -1, -1, -1, -1, -1, -1, -1},
-	{10, 6, 5, 1, 9, 7, 1, 7, 3, 7, 9, 4, -1, -1, -1, -1},
-	{6, 1, 2, 6, 5, 1, 4, 7, 8, -1, -1, -1, -1, -1, -1, -1},
-	{1, 2, 5, 5, 2, 6, 3, 0, 4, 3, 4, 7, -1, -1, -1, -1},
-	{8, 4, 7, 9, 0, 5, 0, 6, 5, 0, 2, 6, -1, -1, -1, -1},
-	{7, 3, 9, 7, 9, 4, 3, 2, 9, 5, 9, 6, 2, 6, 9, -1},
-	{3, 11, 2, 7, 8, 4, 10, 6, 5, -1, -1, -1, -1, -1, -1, -1},
-	{5, 10, 6, 4, 7, 2, 4, 2, 0, 2, 7, 11, -1, -1, -1, -1},
-	{0, 1, 9, 4, 7, 8, 2, 3, 11, 5, 10, 6, -1, -1, -1, -1},
-	{9, 2, 1, 9, 11, 2, 9, 4, 11, 7, 11, 4, 5, 10, 6, -1},
-	{8, 4, 7, 3, 11, 5, 3, 5, 1, 5, 11, 6, -1, -1, -1, -1},
-	{5, 1, 11, 5, 11, 6, 1, 0, 11, 7, 11, 4, 0, 4, 11, -1},
-	{0, 5, 9, 0, 6, 5, 0, 3, 6, 11, 6, 3, 8, 4, 7, -1},
-	{6, 5, 9, 6, 9, 11, 4, 7, 9, 7, 11, 9, -1, -1, -1, -1},
-	{10, 4, 9, 6, 4, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{4, 10, 6, 4, 9, 10, 0, 8, 3, -1, -1, -1, -1, -1, -1, -1},
-	{10, 0, 1, 10, 6, 0, 6, 4, 0, -1, -1, -1, -1, -1, -1, -1},
-	{8, 3, 1, 8, 1, 6, 8, 6, 4, 6, 1, 10, -1, -1, -1, -1},
-	{1, 4, 9, 1, 2, 4, 2, 6, 4, -1, -1, -1, -1, -1, -1, -1},
-	{3, 0, 8, 1, 2, 9, 2, 4, 9, 2, 6, 4, -1, -1, -1, -1},
-	{0, 2, 4, 4, 2, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{8, 3, 2, 8, 2, 4, 4, 2, 6, -1, -1, -1, -1, -1, -1, -1},
-	{10, 4, 9, 10, 6, 4, 11, 2, 3, -1, -1, -1, -1, -1, -1, -1},
-	{0, 8, 2, 2, 8, 11, 4, 9, 10, 4, 10, 6, -1, -1, -1, -1},
-	{3, 11, 2, 0, 1, 6, 0, 6, 4, 6, 1, 10, -1, -1, -1, -1},
-	{6, 4, 1, 6, 1, 10, 4, 8, 1, 2, 1, 11, 8, 11, 1, -1},
-	{9, 6, 4, 9, 3, 6, 9, 1, 3, 11, 6, 3, -1, -1, -1, -1},
-	{8, 11, 1, 8, 1, 0, 11, 6, 1, 9, 1, 4, 6, 4, 1, -1},
-	{3, 11, 6, 3, 6, 0, 0, 6, 4, -1, -1, -1, -1, -1, -1, -1},
-	{6, 4, 8, 11, 6, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{7, 10, 6, 7, 8, 10, 8, 9, 10, -1, -1, -1, -1, -1, -1, -1},
-	{0, 7, 3, 0, 10, 7, 0, 9, 10, 6, 7, 10, -1, -1, -1, -1},
-	{10, 6, 7, 1, 10, 7, 1, 7, 8, 1, 8, 0, -1, -1, -1, -1},
-	{10, 6, 7, 10, 7, 1, 1, 7, 3, -1, -1, -1, -1, -1, -1, -1},
-	{1, 2, 6, 1, 6, 8, 1, 8, 9, 8, 6, 7, -1, -1, -1, -1},
-	{2, 6, 9, 2, 9, 1, 6, 7, 9, 0, 9, 3, 7, 3, 9, -1},
-	{7, 8, 0, 7, 0, 6, 6, 0, 2, -1, -1, -1, -1, -1, -1, -1},
-	{7, 3, 2, 6, 7, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{2, 3, 11, 10, 6, 8, 10, 8, 9, 8, 6, 7, -1, -1, -1, -1},
-	{2, 0, 7, 2, 7, 11, 0, 9, 7, 6, 7, 10, 9, 10, 7, -1},
-	{1, 8, 0, 1, 7, 8, 1, 10, 7, 6, 7, 10, 2, 3, 11, -1},
-	{11, 2, 1, 11, 1, 7, 10, 6, 1, 6, 7, 1, -1, -1, -1, -1},
-	{8, 9, 6, 8, 6, 7, 9, 1, 6, 11, 6, 3, 1, 3, 6, -1},
-	{0, 9, 1, 11, 6, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{7, 8, 0, 7, 0, 6, 3, 11, 0, 11, 6, 0, -1, -1, -1, -1},
-	{7, 11, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{7, 6, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{3, 0, 8, 11, 7, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{0, 1, 9, 11, 7, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{8, 1, 9, 8, 3, 1, 11, 7, 6, -1, -1, -1, -1, -1, -1, -1},
-	{10, 1, 2, 6, 11, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{1, 2, 10, 3, 0, 8, 6, 11, 7, -1, -1, -1, -1, -1, -1, -1},
-	{2, 9, 0, 2, 10, 9, 6, 11, 7, -1, -1, -1, -1, -1, -1, -1},
-	{6, 11, 7, 2, 10, 3, 10, 8, 3, 10, 9, 8, -1, -1, -1, -1},
-	{7, 2, 3, 6, 2, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{7, 0, 8, 7, 6, 0, 6, 2, 0, -1, -1, -1, -1, -1, -1, -1},
-	{2, 7, 6, 2, 3, 7, 0, 1, 9, -1, -1, -1, -1, -1, -1, -1},
-	{1, 6, 2, 1, 8, 6, 1, 9, 8, 8, 7, 6, -1, -1, -1, -1},
-	{10, 7, 6, 10, 1, 7, 1, 3, 7, -1, -1, -1, -1, -1, -1, -1},
-	{10, 7, 6, 1, 7, 10, 1, 8, 7, 1, 0, 8, -1, -1, -1, -1},
-	{0, 3, 7, 0, 7, 10, 0, 10, 9, 6, 10, 7, -1, -1, -1, -1},
-	{7, 6, 10, 7, 10, 8, 8, 10, 9, -1, -1, -1, -1, -1, -1, -1},
-	{6, 8, 4, 11, 8, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{3, 6, 11, 3, 0, 6, 0, 4, 6, -1, -1, -1, -1, -1, -1, -1},
-	{8, 6, 11, 8, 4, 6, 9, 0, 1, -1, -1, -1, -1, -1, -1, -1},
-	{9, 4, 6, 9, 6, 3, 9, 3, 1, 11, 3, 6, -1, -1, -1, -1},
-	{6, 8, 4, 6, 11, 8, 2, 10, 1, -1, -1, -1, -1, -1, -1, -1},
-	{1, 2, 10, 3, 0, 11, 0, 6, 11, 0, 4, 6, -1, -1, -1, -1},
-	{4, 11, 8, 4, 6, 11, 0, 2, 9, 2, 10, 9, -1, -1, -1, -1},
-	{10, 9, 3, 10, 3, 2, 9, 4, 3, 11, 3, 6, 4, 6, 3, -1},
-	{8, 2, 3, 8, 4, 2, 4, 6, 2, -1, -1, -1, -1, -1, -1, -1},
-	{0, 4, 2, 4, 6, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{1, 9, 0, 2, 3, 4, 2, 4, 6, 4, 3, 8, -1, -1, -1, -1},
-	{1, 9, 4, 1, 4, 2, 2, 4, 6, -1, -1, -1, -1, -1, -1, -1},
-	{8, 1, 3, 8, 6, 1, 8, 4, 6, 6, 10, 1, -1, -1, -1, -1},
-	{10, 1, 0, 10, 0, 6, 6, 0, 4, -1, -1, -1, -1, -1, -1, -1},
-	{4, 6, 3, 4, 3, 8, 6, 10, 3, 0, 3, 9, 10, 9, 3, -1},
-	{10, 9, 4, 6, 10, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{4, 9, 5, 7, 6, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{0, 8, 3, 4, 9, 5, 11, 7, 6, -1, -1, -1, -1, -1, -1, -1},
-	{5, 0, 1, 5, 4, 0, 7, 6, 11, -1, -1, -1, -1, -1, -1, -1},
-	{11, 7, 6, 8, 3, 4, 3, 5, 4, 3, 1, 5, -1, -1, -1, -1},
-	{9, 5, 4, 10, 1, 2, 7, 6, 11, -1, -1, -1, -1, -1, -1, -1},
-	{6, 11, 7, 1, 2, 10, 0, 8, 3, 4, 9, 5, -1, -1, -1, -1},
-	{7, 6, 11, 5, 4, 10, 4, 2, 10, 4, 0, 2, -1, -1, -1, -1},
-	{3, 4, 8, 3, 5, 4, 3, 2, 5, 10, 5, 2, 11, 7, 6, -1},
-	{7, 2, 3, 7, 6, 2, 5, 4, 9, -1, -1, -1, -1, -1, -1, -1},
-	{9, 5, 4, 0, 8, 6, 0, 6, 2, 6, 8, 7, -1, -1, -1, -1},
-	{3, 6, 2, 3, 7, 6, 1, 5, 0, 5, 4, 0, -1, -1, -1, -1},
-	{6, 2, 8, 6, 8, 7, 2, 1, 8, 4, 8, 5, 1, 5, 8, -1},
-	{9, 5, 4, 10, 1, 6, 1, 7, 6, 1, 3, 7, -1, -1, -1, -1},
-	{1, 6, 10, 1, 7, 6, 1, 0, 7, 8, 7, 0, 9, 5, 4, -1},
-	{4, 0, 10, 4, 10, 5, 0, 3, 10, 6, 10, 7, 3, 7, 10, -1},
-	{7, 6, 10, 7, 10, 8, 5, 4, 10, 4, 8, 10, -1, -1, -1, -1},
-	{6, 9, 5, 6, 11, 9, 11, 8, 9, -1, -1, -1, -1, -1, -1, -1},
-	{3, 6, 11, 0, 6, 3, 0, 5, 6, 0, 9, 5, -1, -1, -1, -1},
-	{0, 11, 8, 0, 5, 11, 0, 1, 5, 5, 6, 11, -1, -1, -1, -1},
-	{6, 11, 3, 6, 3, 5, 5, 3, 1, -1, -1, -1, -1, -1, -1, -1},
-	{1, 2, 10, 9, 5, 11, 9, 11, 8, 11, 5, 6, -1, -1, -1, -1},
-	{0, 11, 3, 0, 6, 11, 0, 9, 6, 5, 6, 9, 1, 2, 10, -1},
-	{11, 8, 5, 11, 5, 6, 8, 0, 5, 10, 5, 2, 0, 2, 5, -1},
-	{6, 11, 3, 6, 3, 5, 2, 10, 3, 10, 5, 3, -1, -1, -1, -1},
-	{5, 8, 9, 5, 2, 8, 5, 6, 2, 3, 8, 2, -1, -1, -1, -1},
-	{9, 5, 6, 9, 6, 0, 0, 6, 2, -1, -1, -1, -1, -1, -1, -1},
-	{1, 5, 8, 1, 8, 0, 5, 6, 8, 3, 8, 2, 6, 2, 8, -1},
-	{1, 5, 6, 2, 1, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{1, 3, 6, 1, 6, 10, 3, 8, 6, 5, 6, 9, 8, 9, 6, -1},
-	{10, 1, 0, 10, 0, 6, 9, 5, 0, 5, 6, 0, -1, -1, -1, -1},
-	{0, 3, 8, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{10, 5, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{11, 5, 10, 7, 5, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{11, 5, 10, 11, 7, 5, 8, 3, 0, -1, -1, -1, -1, -1, -1, -1},
-	{5, 11, 7, 5, 10, 11, 1, 9, 0, -1, -1, -1, -1, -1, -1, -1},
-	{10, 7, 5, 10, 11, 7, 9, 8, 1, 8, 3, 1, -1, -1, -1, -1},
-	{11, 1, 2, 11, 7, 1, 7, 5, 1, -1, -1, -1, -1, -1, -1, -1},
-	{0, 8, 3, 1, 2, 7, 1, 7, 5, 7, 2, 11, -1, -1, -1, -1},
-	{9, 7, 5, 9, 2, 7, 9, 0, 2, 2, 11, 7, -1, -1, -1, -1},
-	{7, 5, 2, 7, 2, 11, 5, 9, 2, 3, 2, 8, 9, 8, 2, -1},
-	{2, 5, 10, 2, 3, 5, 3, 7, 5, -1, -1, -1, -1, -1, -1, -1},
-	{8, 2, 0, 8, 5, 2, 8, 7, 5, 10, 2, 5, -1, -1, -1, -1},
-	{9, 0, 1, 5, 10, 3, 5, 3, 7, 3, 10, 2, -1, -1, -1, -1},
-	{9, 8, 2, 9, 2, 1, 8, 7, 2, 10, 2, 5, 7, 5, 2, -1},
-	{1, 3, 5, 3, 7, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{0, 8, 7, 0, 7, 1, 1, 7, 5, -1, -1, -1, -1, -1, -1, -1},
-	{9, 0, 3, 9, 3, 5, 5, 3, 7, -1, -1, -1, -1, -1, -1, -1},
-	{9, 8, 7, 5, 9, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{5, 8, 4, 5, 10, 8, 10, 11, 8, -1, -1, -1, -1, -1, -1, -1},
-	{5, 0, 4, 5, 11, 0, 5, 10, 11, 11, 3, 0, -1, -1, -1, -1},
-	{0, 1, 9, 8, 4, 10, 8, 10, 11, 10, 4, 5, -1, -1, -1, -1},
-	{10, 11, 4, 10, 4, 5, 11, 3, 4, 9, 4, 1, 3, 1, 4, -1},
-	{2, 5, 1, 2, 8, 5, 2, 11, 8, 4, 5, 8, -1, -1, -1, -1},
-	{0, 4, 11, 0, 11, 3, 4, 5, 11, 2, 11, 1, 5, 1, 11, -1},
-	{0, 2, 5, 0, 5, 9, 2, 11, 5, 4, 5, 8, 11, 8, 5, -1},
-	{9, 4, 5, 2, 11, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{2, 5, 10, 3, 5, 2, 3, 4, 5, 3, 8, 4, -1, -1, -1, -1},
-	{5, 10, 2, 5, 2, 4, 4, 2, 0, -1, -1, -1, -1, -1, -1, -1},
-	{3, 10, 2, 3, 5, 10, 3, 8, 5, 4, 5, 8, 0, 1, 9, -1},
-	{5, 10, 2, 5, 2, 4, 1, 9, 2, 9, 4, 2, -1, -1, -1, -1},
-	{8, 4, 5, 8, 5, 3, 3, 5, 1, -1, -1, -1, -1, -1, -1, -1},
-	{0, 4, 5, 1, 0, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{8, 4, 5, 8, 5, 3, 9, 0, 5, 0, 3, 5, -1, -1, -1, -1},
-	{9, 4, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{4, 11, 7, 4, 9, 11, 9, 10, 11, -1, -1, -1, -1, -1, -1, -1},
-	{0, 8, 3, 4, 9, 7, 9, 11, 7, 9, 10, 11, -1, -1, -1, -1},
-	{1, 10, 11, 1, 11, 4, 1, 4, 0, 7, 4, 11, -1, -1, -1, -1},
-	{3, 1, 4, 3, 4, 8, 1, 10, 4, 7, 4, 11, 10, 11, 4, -1},
-	{4, 11, 7, 9, 11, 4, 9, 2, 11, 9, 1, 2, -1, -1, -1, -1},
-	{9, 7, 4, 9, 11, 7, 9, 1, 11, 2, 11, 1, 0, 8, 3, -1},
-	{11, 7, 4, 11, 4, 2, 2, 4, 0, -1, -1, -1, -1, -1, -1, -1},
-	{11, 7, 4, 11, 4, 2, 8, 3, 4, 3, 2, 4, -1, -1, -1, -1},
-	{2, 9, 10, 2, 7, 9, 2, 3, 7, 7, 4, 9, -1, -1, -1, -1},
-	{9, 10, 7, 9, 7, 4, 10, 2, 7, 8, 7, 0, 2, 0, 7, -1},
-	{3, 7, 10, 3, 10, 2, 7, 4, 10, 1, 10, 0, 4, 0, 10, -1},
-	{1, 10, 2, 8, 7, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{4, 9, 1, 4, 1, 7, 7, 1, 3, -1, -1, -1, -1, -1, -1, -1},
-	{4, 9, 1, 4, 1, 7, 0, 8, 1, 8, 7, 1, -1, -1, -1, -1},
-	{4, 0, 3, 7, 4, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{4, 8, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{9, 10, 8, 10, 11, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{3, 0, 9, 3, 9, 11, 11, 9, 10, -1, -1, -1, -1, -1, -1, -1},
-	{0, 1, 10, 0, 10, 8, 8, 10, 11, -1, -1, -1, -1, -1, -1, -1},
-	{3, 1, 10, 11, 3, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{1, 2, 11, 1, 11, 9, 9, 11, 8, -1, -1, -1, -1, -1, -1, -1},
-	{3, 0, 9, 3, 9, 11, 1, 2, 9, 2, 11, 9, -1, -1, -1, -1},
-	{0, 2, 11, 8, 0, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{3, 2, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{2, 3, 8, 2, 8, 10, 10, 8, 9, -1, -1, -1, -1, -1, -1, -1},
-	{9, 10, 2, 0, 9, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{2, 3, 8, 2, 8, 10, 0, 1, 8, 1, 10, 8, -1, -1, -1, -1},
-	{1, 10, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{1, 3, 8, 9, 1, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{0, 9, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{0, 3, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
-	{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}
-};
\ No newline at end of file
+size_t MarchingCubes::workspace_memory(void) const {
+	size_t result = m_vertex_tag.capacity() + m_dense_edges.memory() + m_sparse_edges.memory()
+		+ m_cell_code.capacity() + m_cell_triangle.capacity() * sizeof(int) + m_triangle_cell.capacity() * sizeof(size_t) + m_vertex_edge.capacity() * sizeof(size_t) + m_surface_edges.memory();
+	for (const worker_space& W : m_worker) {
+		result += W.row_code.capacity() + W.row_active.capacity() * sizeof(int) + W.edges.memory();
+		result += W.batch.vertex.capacity() * (sizeof(int) + edge_batch::CHANNELS * sizeof(float));
+		result += W.triangles.nTriangles() * sizeof(vec3i) + (W.slice_bits[0].capacity() + W.slice_bits[1].capacity()) * sizeof(uint64_t);
+		result += W.row_values.capacity() * sizeof(float);
+	}
+	for (const brick& B : m_bricks) {
+		result += B.shared.capacity() * sizeof(std::pair<int, size_t>);
+		result += B.M.nVertices() * 3 * sizeof(vec3f) + B.M.nTriangles() * sizeof(vec3i);
+	}
+	result += m_concurrent_edges.memory() + m_chunk_fill.capacity() * sizeof(size_t);
+	result += m_chunks.nVertices() * 3 * sizeof(vec3f) + m_arena.memory();
+	result += m_front.capacity() * sizeof(vec3i) + m_seen_cells.capacity() * sizeof(uint64_t);
+	result += m_field_slab.capacity() * sizeof(float) + m_field_edges.memory();
+	return result + m_stitch.capacity() * sizeof(int);
+}
+
+void MarchingCubes::prepare_workers(void) {
+	// scratch for every thread, row buffers span a whole row
+	m_worker.resize(size_t(threads()));
+	for (worker_space& W : m_worker) {
+		W.row_code.resize(m_vol.dimension(0));
+		W.row_active.resize(m_vol.dimension(0));
+	}
+}
+
+void MarchingCubes::prepare_workspace(void) {
+	// (re-)allocate only if the volume changed its dimensions since the last call
+	std::array<size_t, 3> dims = { m_vol.dimension(0), m_vol.dimension(1), m_vol.dimension(2) };
+	if (dims != m_workspace_dims) {
+		clear();
+		m_vertex_tag.resize(m_vol.size());
+		m_workspace_dims = dims;
+	}
+	prepare_workers();
+	// the map that is not used this time is released, the other one kept or allocated
+	if (edge_map() == SPARSE) {
+		m_dense_edges.release();
+		m_sparse_edges.reserve(m_last_vertices);
+	}
+	else {
+		m_sparse_edges.release();
+		m_dense_edges.resize(3 * m_vol.size());
+	}
+}
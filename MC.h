@@ -3,19 +3,175 @@
 
 #include"mesh.h"
 #include"volume.h"
+#include"implicit_field.h"
+#include"sparse_volume.h"
 #include"ext_math.h"
+#include"progress.h"
+#include"edge_map.h"
+#include"simd.h"
+#include"thread_pool.h"
+#include"arena.h"
+#include<memory>
+#include<atomic>
 
-// MarchingCubes Tables from (http://paulbourke.net/geometry/polygonise/)
-// Also, refer to there for more information
+// The MarchingCubes tables are in MC_tables.h
 class MarchingCubes {
 public:
+	// On a volume, MarchingCubes follows it through resizes and subsample().
+	// On a view (see volume_view), it extracts the voxels of the view in place,
+	// a sub-box, slice or preview without a copy; the mesh is in the grid of the
+	// view, see volume_view::origin() and step() for where that lies.
 	MarchingCubes(const volume& V);
+	MarchingCubes(const volume_view& V);
+	// On an implicit field, compute() evaluates the field slab by slab: the
+	// voxels of FIELD_SLAB cell layers (and one layer on either side, for the
+	// gradients) are evaluated on the pool, tagged and extracted, then dropped,
+	// so the memory needed follows a slab of the grid, not all of it. The cell
+	// loop runs on the calling thread. The mesh is that of compute() on the
+	// field sampled into a volume (up to rounding of the positions).
+	// Only compute() is available on a field: update() returns an empty
+	// surface, count() zeros, propagate() and find_seeds() nothing.
+	static constexpr const int FIELD_SLAB = 16;
+	MarchingCubes(const implicit_field& F);
+	// On a sparse volume, compute() only visits the boxes of LEAF^3 cells (one
+	// per leaf, with corners in that leaf and the next ones along each axis)
+	// that reach an allocated leaf or tiles on both sides of the isovalue,
+	// skipping those whose slot ranges all lie on one side. Each is copied with
+	// one voxel layer around it (for the gradients), tagged and extracted like
+	// a slab of a field, all share one edge map over the whole grid. Time and
+	// memory follow the allocated nodes and the leaves the surface touches,
+	// not the bounding box; the mesh is that of compute() on the dense volume.
+	// As on a field, only compute() is available, the rest return nothing.
+	MarchingCubes(const sparse_volume& S);
 	~MarchingCubes(void);
-	void clear(void);
-	mesh compute(float isovalue);
+	void clear(void);									// releases the workspace memory
+	mesh compute(float isovalue, progress* prog = nullptr);	// prog: optional progress report / cancel token.
+															// RETURNS an empty mesh if cancelled.
+	// Same, but into M, whose storage (heap or arena) is reused: repeated calls
+	// with the same M allocate only when the surface outgrows it. The scratch of
+	// the extraction itself is kept between calls or comes from an arena of
+	// MarchingCubes that is reset on every call.
+	bool compute(float isovalue, mesh& M, progress* prog = nullptr);	// RETURNS false (and M empty) if cancelled
+
+	// Region of interest: compute() only tags the voxels of the box of cells
+	// lo..hi-1 and only visits the cells of the box that reach into every clip
+	// plane. A plane (a,b,c,d) keeps the cells with a corner at a*x+b*y+c*z+d >= 0,
+	// x,y,z in voxels; rows of cells are cut to the kept range before the cell
+	// codes are computed. Cells are kept or dropped whole, triangles are not
+	// cut, so the result is exactly the part of the full mesh these cells
+	// produce, in the same model coordinates.
+	struct region {
+		vec3i lo, hi;
+		std::vector<vec4f> planes;
+		region(void);									// all cells
+		region(const vec3i& lo, const vec3i& hi);		// clamped to the volume
+	};
+	mesh compute(float isovalue, const region& roi, progress* prog = nullptr);
+	bool compute(float isovalue, const region& roi, mesh& M, progress* prog = nullptr);
+
+	// Exact size of the mesh compute(isovalue) would return, without extracting:
+	// one vertex per edge whose ends are on different sides, the triangles of
+	// every cell from its cube code. The tags are kept as bits, so 64 edges are
+	// counted with one popcount and only the active cells are looked at one by
+	// one. Runs on the pool, one slab of COUNT_SLAB cell layers per task, and
+	// leaves the state of update() alone.
+	struct counts {
+		size_t vertices;
+		size_t triangles;
+		size_t cells;									// cells with triangles, the active cells
+	};
+	static constexpr const int COUNT_SLAB = 8;
+	counts count(float isovalue);
+
+	// Extraction of only the surfaces through the seed cells, by propagation:
+	// a breadth-first flood from the seeds over the cells the surface passes
+	// through, from a cell to its neighbor across every face whose corners lie
+	// on both sides of the isovalue. Cells are classified from the voxels
+	// directly (no tags), visited cells are marked in a bitmap (one bit per
+	// cell, kept between calls) and only those marks are undone afterwards, so
+	// the time follows the size of the surface, not of the volume. Vertices go
+	// through the map of edge_map(). The triangles and vertices are those of
+	// compute(), in the order of the flood; cells
+	// that hold pieces of two surfaces contribute both. Seeds without
+	// triangles are skipped. Runs on the calling thread, leaves the state of
+	// update() alone. RETURNS false (and M empty) if cancelled.
+	bool propagate(float isovalue, const std::vector<vec3i>& seeds, mesh& M, progress* prog = nullptr);
+	// Seeds for propagate(): from voxel start along the 6 axes to the first edge
+	// that crosses the isovalue, the surfaces bounding the region around start.
+	// Without start, the search begins at the largest value of the volume
+	// (maximum = true) or at the smallest, i.e. the surface around the
+	// brightest or darkest structure. RETURNS up to 6 seed cells.
+	std::vector<vec3i> find_seeds(float isovalue, const vec3i& start) const;
+	std::vector<vec3i> find_seeds(float isovalue, bool maximum = true) const;
+
+	// Storage for the edge -> vertex map of compute(). DENSE is fastest but needs
+	// 12 bytes per voxel, SPARSE needs memory proportional to the surface only.
+	// AUTO picks DENSE as long as the dense table stays below DENSE_EDGE_MAP_LIMIT.
+	enum edge_map_mode { AUTO, DENSE, SPARSE };
+	static constexpr const size_t DENSE_EDGE_MAP_LIMIT = size_t(256) << 20;
+	void set_edge_map(edge_map_mode mode);
+	edge_map_mode edge_map(void) const;					// mode AUTO resolves to for the current volume
+	size_t workspace_memory(void) const;				// bytes held between calls to compute()
+
+	// Instruction set of the cell code and vertex kernels. All variants are
+	// compiled in, the best one the CPU supports is picked at construction.
+	// set_simd() selects a lower one (for comparisons), never an unsupported one.
+	void set_simd(simd_level level);
+	simd_level simd(void) const;
+
+	// Threads of compute(). With more than one, the cells are split into bricks
+	// of BRICK^3 that are extracted as tasks of a work-stealing thread pool,
+	// which is kept between calls. The bricks are stitched in a fixed order,
+	// so the result does not depend on the scheduling. With one thread, compute()
+	// runs the cell loop directly and keeps the vertex order of the serial loop.
+	static constexpr const int BRICK = 32;
+	void set_threads(int nThreads);						// 0: one per hardware thread (default)
+	int threads(void) const;
+	const thread_pool& scheduler(void);					// the pool, its statistics cover the last compute()
+	// Pinned workers stay on the node whose memory holds their slabs (see numa.h),
+	// on by default on machines with more than one NUMA node.
+	void set_pinning(bool pinned);
+	bool pinning(void) const;
+
+	// UNORDERED skips the stitching: all threads share one concurrent edge map
+	// and create every vertex exactly once, in chunks of vertex ids reserved
+	// atomically. The mesh is the same up to the order of vertices and
+	// triangles, which then varies from run to run. Needs no edge_map() either.
+	enum parallel_mode { ORDERED, UNORDERED };
+	void set_parallel_mode(parallel_mode mode);
+	parallel_mode parallel(void) const;
+
+	// Incremental extraction for interactive isovalue changes. The surface and the
+	// cube code of every cell are kept from the previous call, only cells whose
+	// code changed get new triangles, and only their vertices (the edges next to
+	// a voxel that changed sides) are placed for the new isovalue. The other
+	// vertices keep the position of the isovalue they were placed at, so their
+	// error adds up over several calls until refresh() places all vertices for
+	// the current isovalue, which gives the surface compute() would produce.
+	// Freed triangle slots hold degenerate triangles until more than
+	// 1/FREE_SLOTS of all slots are free, then the live ones move down over them.
+	// delta (optional) receives what changed in surface().
+	// With a value index on the volume (volume::build_index()) re-tagging only
+	// visits the voxels between the old and the new isovalue.
+	// The volume must not change in between (call clear() if it does),
+	// compute() invalidates the kept state, so the next update() starts over.
+	const mesh& update(float isovalue, mesh_delta* delta = nullptr);
+	const mesh& refresh(mesh_delta* delta = nullptr);	// places all vertices of surface() for its isovalue, see update()
+	const mesh& surface(void) const;					// result of the last update()
 
 protected:
-	const volume& m_vol;
+	const volume* m_volume;								// the volume followed, nullptr for a view
+	mutable volume_view m_vol;							// the voxels extracted, see sync_view()
+	void sync_view(void) const;							// takes the current view of m_volume, called by every entry point
+	const implicit_field* m_field;						// the field extracted, nullptr for a volume or view
+	std::vector<float, page_allocator<float>> m_field_slab;	// values of the current slab of m_field or box of m_sparse
+	sparse_edge_map m_field_edges;						// vertices of the slab below, see compute_field()
+	bool compute_field(mesh& M, progress* prog);		// compute() on m_field for the cells m_lo..m_hi-1
+	const sparse_volume* m_sparse;						// the sparse volume extracted, nullptr otherwise
+	bool compute_sparse(mesh& M, progress* prog);		// compute() on m_sparse for the cells m_lo..m_hi-1
+	bool sparse_active(const vec3i& box) const;			// false if the cells of leaf box cannot hold a part of the surface
+	size_t grid_dimension(size_t n) const;				// of m_field, m_sparse or m_vol
+	bool streamed(void) const;							// true on a field or sparse volume, m_vol only holds a slab or box during compute()
 	float m_isovalue;
 	inline size_t linear_address(const vec3i& vox) const;
 
@@ -29,21 +185,147 @@ protected:
 	// RELATED TO STEP 1 -- tagging vertices
 	static constexpr const uint8_t PLUS = 1;
 	static constexpr const uint8_t MINUS = 0;
-	std::vector<uint8_t> m_vertex_tag;
+	std::vector<uint8_t, page_allocator<uint8_t>> m_vertex_tag;	// first touched by tag_vertices()
 	inline uint8_t& vertex_tag(const vec3i& vox);
 	inline const uint8_t& vertex_tag(const vec3i& vox) const;
-	void tag_vertices(void);
+	void tag_vertices(void);							// the voxels of the cells m_lo..m_hi-1
+	void tag_slice(int z);								// the same for one slice, on the calling thread
+	void retag_vertices(float old_isovalue);			// collects changed tags in m_flipped, uses m_vol.index() if present
+	std::vector<size_t> m_flipped;
 
 	// RELATED TO STEP 2 -- computing vertices on edges
 	vec3f grid_normal(const vec3i& vox) const;
 	void edge_vertex(const vec3i& pos1, const vec3i& pos2, vec3f& position, vec3f& gradient, vec3f& color) const;
 	inline size_t edge_id(const vec3i& pos1, const vec3i& pos2) const;
+	inline void edge_ends(size_t id, vec3i& pos1, vec3i& pos2) const;	// inverse of edge_id()
+	void model_transform(vec3f& bias, float& scale) const;	// grid to model coordinates: (pos-bias)*scale
+
+	// Vertices are computed in batches: gather_edge() does the scattered volume
+	// reads of one edge into the structure-of-arrays buffers of a batch, and
+	// interpolate_edges() runs the arithmetic of edge_vertex() on all of them,
+	// one edge per SIMD lane, writing position, normal and color to the mesh.
+	struct edge_batch {
+		enum channel {
+			X1, Y1, Z1, X2, Y2, Z2,						// edge ends
+			VALUE1, VALUE2,								// volume at the ends
+			DIFF1, STEPS1 = DIFF1 + 3,					// right minus left neighbor and number of steps
+			DIFF2 = STEPS1 + 3, STEPS2 = DIFF2 + 3,		// between them (0, 1 or 2) per axis, at both ends
+			CHANNELS = STEPS2 + 3
+		};
+		static constexpr const size_t LANES = 16;		// capacity is kept a multiple of the widest register
+		static constexpr const size_t FLUSH = 4096;		// extraction computes its batch at least this often
+		std::vector<float> data[CHANNELS];
+		std::vector<int> vertex;						// destination vertex per edge
+		size_t size = 0;
+	};
+	void gather_edge(edge_batch& B, const vec3i& pos1, int axis, int vertex) const;
+	void interpolate_edges(edge_batch& B, const vec3f& bias, float scale, mesh& M) const;	// computes and empties B
+
+	// Scratch of one thread of the cell loop
+	struct worker_space {
+		edge_batch batch;
+		std::vector<uint8_t> row_code;					// see cell_codes()
+		std::vector<int> row_active;
+		sparse_edge_map edges;							// edge map of the current brick
+		size_t chunk_next, chunk_end;					// vertex ids left in the current chunk (UNORDERED)
+		mesh triangles;									// triangles of this thread (UNORDERED)
+		size_t count;									// result of count_edge_vertices(), vertices of count()
+		size_t count_triangles;							// triangles of count()
+		size_t count_cells;								// active cells of count()
+		std::vector<uint64_t> slice_bits[2];			// tags of two z-slices, one bit each (count())
+		std::vector<float> row_values;					// a row of a view with gaps between the voxels (count())
+	};
+	// A box of cells lo..hi-1 and its part of the surface. Vertices on a face
+	// that the brick shares with a neighbor are listed in shared (local vertex
+	// id, edge id), the neighbor creates them as well, see stitch().
+	struct brick {
+		vec3i lo, hi;
+		mesh M;
+		std::vector<std::pair<int, size_t>> shared;
+		int first;										// provisional id of local vertex 0
+		int kept;										// vertices that are not duplicates
+		size_t vertex_offset, triangle_offset;			// where the brick goes in the result
+	};
+
+	// cell loop over the cells lo..hi-1, RETURNS false if cancelled.
+	// Output takes the vertices and triangles, see MC.cpp
+	template<class EdgeMap, class Output>
+	bool extract(EdgeMap& edge_map, Output& out, const vec3i& lo, const vec3i& hi, worker_space& W, int worker, progress& prog,
+		std::vector<std::pair<int, size_t>>* shared = nullptr);
+	void make_bricks(void);								// splits the cells m_lo..m_hi-1 into m_bricks
+	bool extract_bricks(mesh& M, progress& prog);		// all bricks on the pool, then stitch()
+	template<class EdgeMap>
+	void stitch(EdgeMap& edge_map, mesh& M);			// joins the bricks into M, edge_map finds the duplicates
+	bool extract_shared(mesh& M, progress& prog);		// all bricks on the pool with m_concurrent_edges
+	size_t count_edge_vertices(void);					// edges whose ends have different tags, on the pool
+	vec3i m_lo, m_hi;									// cells of the current extraction, see region
+	std::vector<vec4f> m_planes;
+	bool clip_row(int y, int z, int& x0, int& x1) const;	// narrows cells x0..x1-1 of row (y,z) to m_planes. RETURNS false if none are left
+	template<class EdgeMap>
+	bool flood(EdgeMap& edge_map, const std::vector<vec3i>& seeds, mesh& M, progress& prog);	// the cell loop of propagate()
+	std::vector<vec3i> m_front;							// cells found by propagate(), in the order of the flood
+	std::vector<uint64_t, page_allocator<uint64_t>> m_seen_cells;	// one bit per cell, only those of m_front are set
+
+	// WORKSPACE -- kept between calls to compute(), so repeated extractions on
+	// the same volume neither allocate nor page-fault fresh memory.
+	// Only the edge map selected by edge_map() is allocated.
+	std::array<size_t, 3> m_workspace_dims;
+	edge_map_mode m_edge_map_mode;
+	dense_edge_map m_dense_edges;
+	sparse_edge_map m_sparse_edges;
+	size_t m_last_vertices, m_last_triangles;
+	simd_level m_simd;
+	int m_threads;
+	bool m_pinned;
+	std::unique_ptr<thread_pool> m_pool;
+	std::vector<worker_space> m_worker;					// one per thread
+	std::vector<brick> m_bricks;
+	std::vector<int> m_stitch;							// final vertex id per provisional id
+	parallel_mode m_parallel_mode;
+	static constexpr const size_t CHUNK = 1024;			// vertex ids reserved at once (UNORDERED)
+	concurrent_edge_map m_concurrent_edges;
+	mesh m_chunks;										// vertices, chunk c holds ids c*CHUNK.. c*CHUNK+m_chunk_fill[c]-1
+	std::vector<size_t> m_chunk_fill;
+	arena m_arena;										// temporaries of one compute()
+	progress m_console;									// compute() without a progress, polled, see extract()
+	static void console_report(const progress& P);		// its callback
+	std::atomic<size_t> m_next_chunk;
+	thread_pool& pool(void);							// created on first use
+	void prepare_workspace(void);
+	void prepare_workers(void);							// the part of prepare_workspace() for m_worker
 
 	// RELATED TO STEP 3 -- cell codes
 	uint8_t compute_cell_code(const vec3i& cell) const;
+	void tag_bits(const float* v, int n, float isovalue, uint64_t* bits) const;	// bit x of bits is the tag of v[x], (n+63)/64 words
+	int cell_codes(int y, int z, int x0, int x1, uint8_t* code, int* active) const;	// codes of cells x0..x1-1 of row (y,z) into code[x],
+																				// x of the cells with triangles into active.
+																				// RETURNS number of those cells.
+
+	// RELATED TO INCREMENTAL EXTRACTION -- see update()
+	// Cells are indexed like their first vertex. The triangles of a cell occupy
+	// a block of consecutive slots in m_surface, blocks of removed cells are
+	// recycled through m_free_triangles, removed vertices through m_free_vertices.
+	static constexpr const size_t NO_EDGE = ~size_t(0);
+	static constexpr const size_t FREE_SLOTS = 8;		// see update()
+	mesh m_surface;
+	bool m_surface_valid;
+	float m_surface_isovalue;
+	bool m_surface_exact;								// all vertices placed for m_surface_isovalue, see refresh()
+	std::vector<uint8_t, page_allocator<uint8_t>> m_cell_code;					// cube code per cell
+	std::vector<int> m_cell_triangle;					// first triangle slot per cell
+	std::vector<size_t> m_triangle_cell;				// cell per triangle slot, the inverse for compact_triangles()
+	std::vector<size_t> m_vertex_edge;					// edge id per vertex, NO_EDGE if free
+	std::vector<int> m_free_vertices;
+	std::vector<int> m_free_triangles[6];				// free blocks of n slots, a cell has at most 5 triangles
+	size_t m_free_slots;								// in all of m_free_triangles
+	std::vector<int> m_placed;							// vertices of the cells update_cell() changed, see place_vertices()
+	sparse_edge_map m_surface_edges;
+	void rebuild_surface(mesh_delta* delta);
+	void update_cell(const vec3i& cell, uint8_t code, mesh_delta* delta);
+	int surface_vertex(const vec3i& pos1, const vec3i& pos2);	// slot for the vertex on the edge, see place_vertices()
+	void place_vertices(mesh_delta* delta);				// (re-)computes the vertices in m_placed for m_isovalue
+	void compact_triangles(mesh_delta* delta);			// moves the live triangles down over the free slots
 
-	static const int edge_table[256];
-	static const int triTable[256][16];
 private:
 	MarchingCubes(const MarchingCubes&);		// make copy constructor inaccessible. Copying a MC object is not meaningful.
 };
@@ -63,9 +345,17 @@ inline const uint8_t& MarchingCubes::vertex_tag(const vec3i& vox) const {
 inline size_t MarchingCubes::edge_id(const vec3i& pos1, const vec3i& pos2) const {
 	vec3i dir = std::abs(pos2 - pos1);
 	assert("MarchingCubes::edge_id() -- invalid argument(s)" && dir.length() == 1);
-	return size_t(dir.dot(vec3i(0, 1, 2))) * m_vol.size() + linear_address(pos1);
+	// edges are identified by their lower end, no matter in which direction they are given
+	return size_t(dir.dot(vec3i(0, 1, 2))) * m_vol.size() + linear_address(std::min(pos1, pos2));
 }
 
+inline void MarchingCubes::edge_ends(size_t id, vec3i& pos1, vec3i& pos2) const {
+	assert("MarchingCubes::edge_ends() -- invalid argument" && id < 3 * m_vol.size());
+	size_t n = id % m_vol.size();
+	size_t dimx = m_vol.dimension(0), dimy = m_vol.dimension(1);
+	pos1 = vec3i(int(n % dimx), int((n / dimx) % dimy), int(n / (dimx * dimy)));
+	pos2 = pos1;
+	pos2[id / m_vol.size()]++;
+}
 
 #endif
-
@@ -0,0 +1,136 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include<cassert>
+#include<cstddef>
+#include<algorithm>
+#include<type_traits>
+#include<utility>
+#include<vector>
+#include"page_allocator.h"
+
+// A monotonic arena: allocate() bumps an offset through the current block,
+// nothing is freed on its own, reset() makes all of it available again.
+// The first round of allocations grows the arena block by block; reset() then
+// merges the blocks into one of their total size, so the next rounds (with the
+// same or smaller needs) do not call the system allocator at all.
+// Not thread safe, allocate from one thread at a time.
+class arena {
+public:
+	inline explicit arena(size_t block = size_t(64) << 10);	// size of the first block
+	inline ~arena(void);									// frees all blocks
+	inline void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+	inline void reset(void);								// forgets all allocations, keeps the memory
+	inline void release(void);								// forgets all allocations, frees the memory
+	inline size_t memory(void) const;						// bytes held
+	inline size_t used(void) const;							// bytes handed out since the last reset()
+	inline size_t blocks_allocated(void) const;				// blocks taken from the system since construction
+protected:
+	struct block {
+		char* data;
+		size_t size;
+	};
+	inline void add_block(size_t size);
+	std::vector<block> m_blocks;							// the last one is current
+	size_t m_offset;										// in the current block
+	size_t m_used;
+	size_t m_first_block;
+	size_t m_allocated;
+private:
+	arena(const arena&);									// not copyable, containers point to it
+};
+
+// STL allocator on top of an arena. Without an arena (the default) it uses the
+// heap like std::allocator. A container keeps the arena it was created with:
+// assigning or swapping does not hand it on, and copies go to the heap.
+template<class T>
+struct arena_allocator {
+	using value_type = T;
+	using propagate_on_container_copy_assignment = std::false_type;
+	using propagate_on_container_move_assignment = std::false_type;
+	using propagate_on_container_swap = std::false_type;
+	arena* storage;
+	arena_allocator(arena* a = nullptr) noexcept : storage(a) {}
+	template<class U> arena_allocator(const arena_allocator<U>& other) noexcept : storage(other.storage) {}
+	T* allocate(size_t n) {
+		if (storage) return static_cast<T*>(storage->allocate(n * sizeof(T), alignof(T)));
+		return std::allocator<T>().allocate(n);
+	}
+	void deallocate(T* p, size_t n) noexcept {
+		if (!storage) std::allocator<T>().deallocate(p, n);
+	}
+	arena_allocator select_on_container_copy_construction(void) const { return arena_allocator(); }
+};
+
+template<class T, class U>
+inline bool operator==(const arena_allocator<T>& a, const arena_allocator<U>& b) { return a.storage == b.storage; }
+template<class T, class U>
+inline bool operator!=(const arena_allocator<T>& a, const arena_allocator<U>& b) { return a.storage != b.storage; }
+
+inline arena::arena(size_t block) : m_offset(0), m_used(0), m_first_block(std::max<size_t>(block, 64)), m_allocated(0) {
+}
+
+inline arena::~arena(void) {
+	release();
+}
+
+inline void arena::add_block(size_t size) {
+	block b = { page_allocator<char>().allocate(size), size };
+	m_blocks.push_back(b);
+	m_offset = 0;
+	m_allocated++;
+}
+
+inline void* arena::allocate(size_t bytes, size_t alignment) {
+	assert("arena::allocate() -- alignment must be a power of two" && alignment > 0 && (alignment & (alignment - 1)) == 0);
+	if (bytes == 0) bytes = 1;
+	size_t start = 0;
+	if (!m_blocks.empty()) {
+		const block& b = m_blocks.back();
+		start = (reinterpret_cast<uintptr_t>(b.data) + m_offset + alignment - 1) & ~uintptr_t(alignment - 1);
+		start -= reinterpret_cast<uintptr_t>(b.data);
+	}
+	if (m_blocks.empty() || start + bytes > m_blocks.back().size) {
+		// blocks double, so a round of n bytes needs O(log n) of them
+		size_t size = m_blocks.empty() ? m_first_block : 2 * m_blocks.back().size;
+		add_block(std::max(size, bytes + alignment));
+		const block& b = m_blocks.back();
+		start = ((reinterpret_cast<uintptr_t>(b.data) + alignment - 1) & ~uintptr_t(alignment - 1)) - reinterpret_cast<uintptr_t>(b.data);
+	}
+	m_offset = start + bytes;
+	m_used += bytes;
+	return m_blocks.back().data + start;
+}
+
+inline void arena::reset(void) {
+	if (m_blocks.size() > 1) {
+		size_t total = memory();
+		release();
+		add_block(total);
+	}
+	m_offset = 0;
+	m_used = 0;
+}
+
+inline void arena::release(void) {
+	for (const block& b : m_blocks) page_allocator<char>().deallocate(b.data, b.size);
+	m_blocks.clear();
+	m_offset = 0;
+	m_used = 0;
+}
+
+inline size_t arena::memory(void) const {
+	size_t result = 0;
+	for (const block& b : m_blocks) result += b.size;
+	return result;
+}
+
+inline size_t arena::used(void) const {
+	return m_used;
+}
+
+inline size_t arena::blocks_allocated(void) const {
+	return m_allocated;
+}
+
+#endif
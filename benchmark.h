@@ -0,0 +1,594 @@
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+#include<cstdio>
+#include<utility>
+#include<atomic>
+#include"timer.h"
+#include"volume.h"
+#include"mesh.h"
+#include"MC.h"
+#include"mesh_components.h"
+#include"synthetic_fields.h"
+#include"page_allocator.h"
+#if defined(__linux__)
+#include<unistd.h>
+#include<sys/ioctl.h>
+#include<sys/syscall.h>
+#include<linux/perf_event.h>
+#endif
+
+// Benchmarks for the extraction pipeline. These are not run by the viewer,
+// start the program as "Assignment2 --bench [dims] [simd]" instead (see main()).
+
+inline void bench_report(const char* name, double seconds) {
+	printf("  %-44s %10.4fs\n", name, seconds);
+}
+
+// Data TLB load misses of the calling thread and the threads it starts after
+// start() (perf_event_open, Linux only). valid() is false where the counter is
+// not available: other systems, virtual machines without a PMU, or a
+// perf_event_paranoid setting that does not allow it.
+class dtlb_counter {
+public:
+	dtlb_counter(void) : m_fd(-1) {
+#if defined(__linux__)
+		perf_event_attr attr = {};
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		attr.disabled = 1;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		m_fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+	}
+	~dtlb_counter(void) {
+#if defined(__linux__)
+		if (m_fd >= 0) close(m_fd);
+#endif
+	}
+	bool valid(void) const { return m_fd >= 0; }
+	void start(void) {
+#if defined(__linux__)
+		if (!valid()) return;
+		ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+	}
+	unsigned long long stop(void) {					// RETURNS misses since start()
+		unsigned long long count = 0;
+#if defined(__linux__)
+		if (!valid()) return 0;
+		ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(m_fd, &count, sizeof(count)) != ssize_t(sizeof(count))) count = 0;
+#endif
+		return count;
+	}
+protected:
+	int m_fd;
+private:
+	dtlb_counter(const dtlb_counter&);
+};
+
+// Ownership transfer of volumes and meshes: a deep copy now has to be written
+// out, assigning a temporary (a generated volume, a subsampled volume or the
+// result of compute()) just hands over its storage.
+inline void bench_ownership(const volume& V, MarchingCubes& MC, float isovalue) {
+	printf("ownership (%zi x %zi x %zi, iso=%.2f)\n", V.dimension(0), V.dimension(1), V.dimension(2), isovalue);
+	timer t;
+
+	volume A(V);
+	bench_report("volume: explicit deep copy", t.query());
+	t.reset();
+	volume B;
+	B = std::move(A);
+	bench_report("volume: move assignment", t.query());
+
+	t.reset();
+	volume C = B.subsampled();
+	bench_report("volume: subsampled()", t.query());
+	t.reset();
+	B.subsample();
+	bench_report("volume: subsample() (subsampled() + move)", t.query());
+
+	mesh M = MC.compute(isovalue);
+	t.reset();
+	mesh N(M);
+	bench_report("mesh: explicit deep copy", t.query());
+	t.reset();
+	N = std::move(M);
+	bench_report("mesh: move assignment", t.query());
+}
+
+// Dense versus sparse edge -> vertex map. Each mode is run twice, the
+// second (reported) run reuses the workspace of the first.
+inline void bench_edge_maps(MarchingCubes& MC, float isovalue) {
+	printf("edge maps (iso=%.2f)\n", isovalue);
+	const MarchingCubes::edge_map_mode modes[] = { MarchingCubes::DENSE, MarchingCubes::SPARSE };
+	const char* names[] = { "dense", "sparse" };
+	for (int n = 0; n < 2; n++) {
+		MC.set_edge_map(modes[n]);
+		MC.compute(isovalue);
+		timer t;
+		MC.compute(isovalue);
+		double seconds = t.query();
+		char name[64];
+		snprintf(name, sizeof(name), "%s: compute() [%.1f MB workspace]", names[n], double(MC.workspace_memory()) / double(1 << 20));
+		bench_report(name, seconds);
+	}
+	MC.set_edge_map(MarchingCubes::AUTO);
+}
+
+// Incremental update() versus a full compute() for the isovalue steps of the viewer.
+// Run it with and without volume::build_index() to see the re-tagging cost.
+inline void bench_incremental(const volume& V, MarchingCubes& MC, float isovalue, float step) {
+	printf("incremental (iso=%.2f, step=%.2f, %s)\n", isovalue, step, V.index() ? "value index" : "no value index");
+	mesh_delta delta;
+	timer t;
+	MC.compute(isovalue + step);
+	bench_report("compute()", t.query());
+	MC.update(isovalue);
+	t.reset();
+	MC.update(isovalue + step, &delta);
+	char name[96];
+	snprintf(name, sizeof(name), "update() [-%zi +%zi triangles]", delta.removed.size(), delta.added.size());
+	bench_report(name, t.query());
+}
+
+// Cell throughput of compute() (tagging included), best of nRuns.
+inline void bench_cells(const volume& V, MarchingCubes& MC, float isovalue, int nRuns = 3) {
+	printf("cells (iso=%.2f)\n", isovalue);
+	double best = 1e30;
+	for (int n = 0; n < nRuns; n++) {
+		timer t;
+		MC.compute(isovalue);
+		best = std::min(best, t.query());
+	}
+	double nCells = double(V.dimension(0) - 1) * double(V.dimension(1) - 1) * double(V.dimension(2) - 1);
+	char name[96];
+	snprintf(name, sizeof(name), "compute() [%.1f Mcells/s]", nCells / best * 1e-6);
+	bench_report(name, best);
+}
+
+// The same extraction with every kernel variant the CPU supports, see
+// MarchingCubes::set_simd(). The variant selected before is restored.
+inline void bench_simd(const volume& V, MarchingCubes& MC, float isovalue, int nRuns = 3) {
+	printf("SIMD kernels (iso=%.2f, detected %s)\n", isovalue, simd_name(simd_detect()));
+	simd_level selected = MC.simd();
+	double nCells = double(V.dimension(0) - 1) * double(V.dimension(1) - 1) * double(V.dimension(2) - 1);
+	for (int level = SIMD_SCALAR; level <= simd_detect(); level++) {
+		MC.set_simd(simd_level(level));
+		double best = 1e30;
+		for (int n = 0; n < nRuns; n++) {
+			timer t;
+			MC.compute(isovalue);
+			best = std::min(best, t.query());
+		}
+		char name[96];
+		snprintf(name, sizeof(name), "compute() %s [%.1f Mcells/s]", simd_name(simd_level(level)), nCells / best * 1e-6);
+		bench_report(name, best);
+	}
+	MC.set_simd(selected);
+}
+
+// compute() on 1, 2, 4, ... 64 threads. Besides the time, the busy time of the
+// workers of the pool shows how well the bricks were balanced: balance is
+// mean over maximum busy time, 1 when every worker was busy equally long.
+inline void bench_threads(const volume& V, MarchingCubes& MC, float isovalue, int nRuns = 3) {
+	printf("threads (iso=%.2f, %u hardware threads)\n", isovalue, std::thread::hardware_concurrency());
+	int selected = MC.threads();
+	double nCells = double(V.dimension(0) - 1) * double(V.dimension(1) - 1) * double(V.dimension(2) - 1);
+	for (int n = 1; n <= thread_pool::MAX_THREADS; n *= 2) {
+		MC.set_threads(n);
+		double best = 1e30;
+		for (int r = 0; r < nRuns; r++) {
+			timer t;
+			MC.compute(isovalue);
+			best = std::min(best, t.query());
+		}
+		char name[96];
+		snprintf(name, sizeof(name), "compute() %2d threads [%.1f Mcells/s]", n, nCells / best * 1e-6);
+		bench_report(name, best);
+		if (n == 1) continue;
+		const thread_pool& P = MC.scheduler();
+		double sum = 0.0, most = 0.0, least = 1e30;
+		size_t stolen = 0;
+		for (int w = 0; w < P.size(); w++) {
+			sum += P.busy(w);
+			most = std::max(most, P.busy(w));
+			least = std::min(least, P.busy(w));
+			stolen += P.stolen(w);
+		}
+		printf("    busy min/mean/max %.4f/%.4f/%.4fs, balance %.2f, %zi stolen\n", least, sum / P.size(), most, most > 0.0 ? sum / P.size() / most : 1.0, stolen);
+	}
+	MC.set_threads(selected);
+}
+
+// Ordered (bricks with stitching) against unordered (one concurrent edge map,
+// vertices in chunks) parallel extraction at thread counts past the core count
+// of a workstation, where the stitching pass starts to show.
+inline void bench_parallel_modes(const volume& V, MarchingCubes& MC, float isovalue, int nRuns = 3) {
+	printf("parallel modes (iso=%.2f)\n", isovalue);
+	int selected = MC.threads();
+	MarchingCubes::parallel_mode mode = MC.parallel();
+	double nCells = double(V.dimension(0) - 1) * double(V.dimension(1) - 1) * double(V.dimension(2) - 1);
+	const MarchingCubes::parallel_mode modes[2] = { MarchingCubes::ORDERED, MarchingCubes::UNORDERED };
+	const char* names[2] = { "ordered", "unordered" };
+	for (int n = 8; n <= 32; n *= 2) {
+		MC.set_threads(n);
+		for (int m = 0; m < 2; m++) {
+			MC.set_parallel_mode(modes[m]);
+			double best = 1e30;
+			for (int r = 0; r < nRuns; r++) {
+				timer t;
+				MC.compute(isovalue);
+				best = std::min(best, t.query());
+			}
+			char name[96];
+			snprintf(name, sizeof(name), "%-9s %2d threads [%.1f Mcells/s]", names[m], n, nCells / best * 1e-6);
+			bench_report(name, best);
+		}
+	}
+	MC.set_parallel_mode(mode);
+	MC.set_threads(selected);
+}
+
+// Placement of the voxels on the memory nodes, with pinned workers. On a
+// single node machine the three are the same (up to noise).
+inline void bench_numa(const volume& V, MarchingCubes& MC, float isovalue, int nRuns = 3) {
+	printf("NUMA placement (iso=%.2f, %d nodes, %d threads)\n", isovalue, numa_nodes(), MC.threads());
+	const numa_placement placements[3] = { NUMA_FIRST_TOUCH, NUMA_INTERLEAVED, NUMA_SINGLE_NODE };
+	double nCells = double(V.dimension(0) - 1) * double(V.dimension(1) - 1) * double(V.dimension(2) - 1);
+	for (numa_placement placement : placements) {
+		volume W;
+		W.place(placement);
+		W.copy_from(V);
+		MarchingCubes M(W);
+		M.set_threads(MC.threads());
+		M.set_pinning(true);
+		M.set_simd(MC.simd());
+		double best = 1e30;
+		for (int r = 0; r < nRuns; r++) {
+			timer t;
+			M.compute(isovalue);
+			best = std::min(best, t.query());
+		}
+		char name[96];
+		snprintf(name, sizeof(name), "compute() %s [%.1f Mcells/s]", numa_name(placement), nCells / best * 1e-6);
+		bench_report(name, best);
+	}
+}
+
+// Page size of the voxels and of the extraction scratch. Every mode gets its
+// own copy of the volume and its own MarchingCubes, so that all their arrays
+// are allocated under that mode. The first compute() allocates, the timed ones
+// reuse the workspace.
+inline void bench_huge_pages(const volume& V, MarchingCubes& MC, float isovalue, int nRuns = 3) {
+	printf("page size (iso=%.2f)\n", isovalue);
+	const huge_page_mode modes[3] = { HUGE_PAGES_OFF, HUGE_PAGES_TRANSPARENT, HUGE_PAGES_EXPLICIT };
+	huge_page_mode selected = huge_pages();
+	size_t fallbacks = huge_page_fallbacks();
+	double nCells = double(V.dimension(0) - 1) * double(V.dimension(1) - 1) * double(V.dimension(2) - 1);
+	dtlb_counter counter;
+	for (huge_page_mode mode : modes) {
+		set_huge_pages(mode);
+		volume W;
+		W.copy_from(V);
+		MarchingCubes M(W);
+		M.set_threads(MC.threads());
+		M.set_simd(MC.simd());
+		M.set_edge_map(MC.edge_map());
+		M.compute(isovalue);
+		double best = 1e30;
+		unsigned long long misses = ~0ull;
+		for (int r = 0; r < nRuns; r++) {
+			counter.start();
+			timer t;
+			M.compute(isovalue);
+			best = std::min(best, t.query());
+			misses = std::min(misses, counter.stop());
+		}
+		char name[96];
+		snprintf(name, sizeof(name), "compute() %s [%.1f Mcells/s]", huge_page_name(mode), nCells / best * 1e-6);
+		bench_report(name, best);
+		if (counter.valid()) printf("    %llu dTLB load misses, %.3f per cell\n", misses, double(misses) / nCells);
+	}
+	if (!counter.valid()) printf("    dTLB miss counter not available\n");
+	if (huge_page_fallbacks() > fallbacks) printf("    no reserved huge pages, EXPLICIT fell back %zu times\n", huge_page_fallbacks() - fallbacks);
+	set_huge_pages(selected);
+}
+
+// Heap allocations per compute() once the workspace exists, counted by the
+// operator new main.cpp replaces when built with MC_COUNT_ALLOCATIONS
+// defined, otherwise there is nothing to count. A new mesh per call
+// costs its four arrays, compute() into the same mesh reuses them and
+// allocates nothing.
+inline std::atomic<size_t>& bench_heap_allocations(void) {
+	static std::atomic<size_t> count(0);
+	return count;
+}
+
+inline void bench_allocations(MarchingCubes& MC, float isovalue, int nRuns = 4) {
+	printf("heap allocations per compute() (iso=%.2f)\n", isovalue);
+#ifndef MC_COUNT_ALLOCATIONS
+	(void)MC;
+	(void)nRuns;
+	printf("  not counted, build with MC_COUNT_ALLOCATIONS defined\n");
+#else
+	int selected = MC.threads();
+	MarchingCubes::parallel_mode mode = MC.parallel();
+	const int threads[3] = { 1, std::max(selected, 2), std::max(selected, 2) };
+	const MarchingCubes::parallel_mode modes[3] = { MarchingCubes::ORDERED, MarchingCubes::ORDERED, MarchingCubes::UNORDERED };
+	for (int c = 0; c < 3; c++) {
+		MC.set_threads(threads[c]);
+		MC.set_parallel_mode(modes[c]);
+		mesh M;
+		MC.compute(isovalue, M);
+		size_t start = bench_heap_allocations();
+		for (int r = 0; r < nRuns; r++) M = MC.compute(isovalue);
+		double fresh = double(bench_heap_allocations() - start) / nRuns;
+		start = bench_heap_allocations();
+		for (int r = 0; r < nRuns; r++) MC.compute(isovalue, M);
+		double reused = double(bench_heap_allocations() - start) / nRuns;
+		printf("  %2d threads %-9s: %.1f for a new mesh, %.1f into the same mesh\n", threads[c], modes[c] == MarchingCubes::UNORDERED ? "unordered" : "ordered", fresh, reused);
+	}
+	MC.set_parallel_mode(mode);
+	MC.set_threads(selected);
+#endif
+}
+
+// count() against the extraction it predicts.
+inline void bench_count(MarchingCubes& MC, float isovalue, int nRuns = 3) {
+	printf("count (iso=%.2f)\n", isovalue);
+	double counting = 1e30, extracting = 1e30;
+	MarchingCubes::counts c = { 0, 0, 0 };
+	mesh M;
+	for (int r = 0; r < nRuns; r++) {
+		timer t;
+		c = MC.count(isovalue);
+		counting = std::min(counting, t.query());
+		t.reset();
+		MC.compute(isovalue, M);
+		extracting = std::min(extracting, t.query());
+	}
+	char name[96];
+	snprintf(name, sizeof(name), "count() [%zu vertices, %zu triangles]", c.vertices, c.triangles);
+	bench_report(name, counting);
+	snprintf(name, sizeof(name), "compute() [%.1fx count()]", extracting / counting);
+	bench_report(name, extracting);
+	if (c.vertices != M.nVertices() || c.triangles != M.nTriangles()) printf("    MISMATCH: compute() made %zu vertices, %zu triangles\n", M.nVertices(), M.nTriangles());
+}
+
+// Contour spectrum: one pass for all isovalues against count() and compute()
+// at the sample nearest to isovalue. The triangle counts have to agree, the
+// area is compared with that of the extracted mesh (in voxel units).
+inline void bench_spectrum(const volume& V, MarchingCubes& MC, float isovalue, int nSamples = 256) {
+	printf("contour spectrum (%d isovalues)\n", nSamples);
+	std::array<int, 3> dims = { int(V.dimension(0)), int(V.dimension(1)), int(V.dimension(2)) };
+	timer t;
+	contour_spectrum serial(&V[0], dims, nSamples);
+	bench_report("1 thread", t.query());
+	thread_pool pool;
+	t.reset();
+	contour_spectrum S(&V[0], dims, nSamples, &pool);
+	char name[96];
+	snprintf(name, sizeof(name), "thread_pool, %d threads", pool.size());
+	bench_report(name, t.query());
+
+	int j = 0;
+	for (int n = 1; n < S.size(); n++) {
+		if (std::fabs(S[n].isovalue - isovalue) < std::fabs(S[j].isovalue - isovalue)) j = n;
+	}
+	const contour_spectrum::sample& s = S[j];
+	MarchingCubes::counts c = MC.count(s.isovalue);
+	mesh M = MC.compute(s.isovalue);
+	const float scale = 2.0f / float(std::max(dims[0], std::max(dims[1], dims[2])));
+	double area = 0.0;
+	for (size_t n = 0; n < M.nTriangles(); n++) {
+		const vec3i& T = M.triangle(int(n));
+		area += 0.5 * double(((M.position(T[1]) - M.position(T[0])) ^ (M.position(T[2]) - M.position(T[0]))).length());
+	}
+	area /= double(scale) * double(scale);
+	printf("    iso=%.4f: %zu triangles, area %.1f (mesh %.1f), enclosed volume %.0f\n", s.isovalue, s.triangles, s.area, area, s.volume);
+	if (s.triangles != c.triangles || s.triangles != M.nTriangles() || serial[j].triangles != s.triangles) printf("    MISMATCH: count() %zu, compute() %zu triangles\n", c.triangles, M.nTriangles());
+}
+
+// Propagation from seeds found at the largest value against the full cell
+// loop. On a volume with a single surface both produce the same triangles.
+inline void bench_propagation(MarchingCubes& MC, float isovalue, int nRuns = 3) {
+	printf("propagation (iso=%.2f)\n", isovalue);
+	double full = 1e30, seeding = 1e30, flooding = 1e30;
+	mesh A, B;
+	std::vector<vec3i> seeds;
+	for (int r = 0; r < nRuns; r++) {
+		timer t;
+		MC.compute(isovalue, A);
+		full = std::min(full, t.query());
+		t.reset();
+		seeds = MC.find_seeds(isovalue);
+		seeding = std::min(seeding, t.query());
+		t.reset();
+		MC.propagate(isovalue, seeds, B);
+		flooding = std::min(flooding, t.query());
+	}
+	char name[96];
+	bench_report("compute()", full);
+	snprintf(name, sizeof(name), "find_seeds() [%zu seeds]", seeds.size());
+	bench_report(name, seeding);
+	snprintf(name, sizeof(name), "propagate() [%zu of %zu triangles]", B.nTriangles(), A.nTriangles());
+	bench_report(name, flooding);
+}
+
+// Connected components of a surface with noise fragments: the volume gets
+// a deterministic speckle of amplitude noise, which breaks small bubbles off
+// the surface. Labels with one thread and on a pool, then keeps the largest.
+inline void bench_components(const volume& V, float isovalue, float noise = 0.05f) {
+	printf("connected components (iso=%.2f, noise %.2f)\n", isovalue, noise);
+	volume noisy(V);
+	for (size_t n = 0; n < noisy.size(); n++) {
+		uint32_t h = uint32_t(n) * 2654435761u;
+		h ^= h >> 15;
+		noisy[n] += noise * (float(h & 0xffff) / 32768.0f - 1.0f);
+	}
+	MarchingCubes MC(noisy);
+	mesh M;
+	MC.compute(isovalue, M);
+	timer t;
+	mesh_components serial(M);
+	bench_report("label, 1 thread", t.query());
+	thread_pool pool;
+	t.reset();
+	mesh_components C(M, &pool);
+	char name[96];
+	snprintf(name, sizeof(name), "label, thread_pool of %d [%d components]", pool.size(), C.size());
+	bench_report(name, t.query());
+	const size_t nTriangles = M.nTriangles(), nVertices = M.nVertices();
+	t.reset();
+	size_t removed = C.keep_largest(M, 1);
+	snprintf(name, sizeof(name), "keep_largest(1) [-%zu of %zu triangles, -%zu of %zu vertices]", removed, nTriangles, nVertices - M.nVertices(), nVertices);
+	bench_report(name, t.query());
+	if (serial.size() != C.size() || (C.size() > 0 && M.nTriangles() != C.triangles(0))) printf("    MISMATCH: %d components with 1 thread\n", serial.size());
+}
+
+// Region of interest against the full volume: the octant at the origin (1/8
+// of the cells), then the same octant cut in half by the clip plane x = y.
+inline void bench_region(const volume& V, MarchingCubes& MC, float isovalue, int nRuns = 3) {
+	printf("region of interest (iso=%.2f)\n", isovalue);
+	const vec3i dims(int(V.dimension(0)), int(V.dimension(1)), int(V.dimension(2)));
+	MarchingCubes::region box(vec3i(0, 0, 0), dims / 2);
+	MarchingCubes::region clipped = box;
+	clipped.planes.push_back(vec4f(1.0f, -1.0f, 0.0f, 0.0f));
+	const MarchingCubes::region* regions[3] = { nullptr, &box, &clipped };
+	const char* names[3] = { "full volume", "octant", "octant, clipped" };
+	mesh M;
+	for (int r = 0; r < 3; r++) {
+		double best = 1e30;
+		for (int n = 0; n < nRuns; n++) {
+			timer t;
+			if (regions[r]) MC.compute(isovalue, *regions[r], M);
+			else MC.compute(isovalue, M);
+			best = std::min(best, t.query());
+		}
+		char name[96];
+		snprintf(name, sizeof(name), "%s [%zu triangles]", names[r], M.nTriangles());
+		bench_report(name, best);
+	}
+}
+
+// Views against copies: the octant at the origin and a preview of every
+// second voxel, extracted in place from a volume_view and from a volume the
+// view was copied into first (copy included in the time).
+inline void bench_views(const volume& V, float isovalue, int nRuns = 3) {
+	printf("volume views (iso=%.2f)\n", isovalue);
+	const vec3i dims(int(V.dimension(0)), int(V.dimension(1)), int(V.dimension(2)));
+	const volume_view views[2] = { V.view(vec3i(0, 0, 0), dims / 2), V.view(vec3i(0, 0, 0), dims, 2) };
+	const char* names[2] = { "octant", "preview, step 2" };
+	mesh M;
+	for (int v = 0; v < 2; v++) {
+		double best[2] = { 1e30, 1e30 };
+		size_t bytes = 0;
+		for (int n = 0; n < nRuns; n++) {
+			timer t;
+			MarchingCubes MV(views[v]);
+			MV.set_threads(1);
+			MV.compute(isovalue, M);
+			best[0] = std::min(best[0], t.query());
+			t.reset();
+			volume C(views[v]);
+			MarchingCubes MC(C);
+			MC.set_threads(1);
+			MC.compute(isovalue, M);
+			best[1] = std::min(best[1], t.query());
+			bytes = C.size() * sizeof(float);
+		}
+		char name[96];
+		snprintf(name, sizeof(name), "%s, view [%zu triangles]", names[v], M.nTriangles());
+		bench_report(name, best[0]);
+		snprintf(name, sizeof(name), "%s, copy [%.1f MB more]", names[v], double(bytes) / double(1 << 20));
+		bench_report(name, best[1]);
+	}
+}
+
+// An implicit field extracted slab by slab against sampling it into a volume
+// first (on a pool) and extracting that, with the memory each one holds.
+inline void bench_field(const implicit_field& F, float isovalue) {
+	printf("implicit field %zu x %zu x %zu (iso=%.2f)\n", F.dimension(0), F.dimension(1), F.dimension(2), isovalue);
+	mesh M;
+	timer t;
+	MarchingCubes MF(F);
+	MF.compute(isovalue, M);
+	char name[96];
+	snprintf(name, sizeof(name), "field [%zu triangles, %.1f MB]", M.nTriangles(), double(MF.workspace_memory()) / double(1 << 20));
+	bench_report(name, t.query());
+	t.reset();
+	{
+		thread_pool pool;
+		volume V;
+		F.fill(V, &pool);
+		MarchingCubes MV(V);
+		MV.compute(isovalue, M);
+		snprintf(name, sizeof(name), "volume [%zu triangles, %.1f MB]", M.nTriangles(), double(V.size() * sizeof(float) + MV.workspace_memory()) / double(1 << 20));
+	}
+	bench_report(name, t.query());
+}
+
+// Extraction throughput against the fraction of active cells (cells the
+// surface passes through) over the synthetic suite at n^3, best of nRuns.
+// Cells per second fall as more of them are active; triangles per second
+// show the cost per triangle once most cells produce some.
+inline void bench_synthetic(int n, int nRuns = 3) {
+	printf("synthetic suite %d^3: throughput against active cells\n", n);
+	thread_pool pool;
+	for (const synthetic_dataset& D : synthetic_suite(n)) {
+		volume V;
+		D.field.fill(V, &pool);
+		MarchingCubes MC(V);
+		const MarchingCubes::counts c = MC.count(D.isovalue);
+		const double nCells = double(n - 1) * double(n - 1) * double(n - 1);
+		mesh M;
+		double best = 1e30;
+		for (int r = 0; r < nRuns; r++) {
+			timer t;
+			MC.compute(D.isovalue, M);
+			best = std::min(best, t.query());
+		}
+		char name[128];
+		snprintf(name, sizeof(name), "%-26s [%5.1f%% active, %6.1f Mcells/s, %5.1f Mtri/s]", D.name.c_str(),
+			100.0 * double(c.cells) / nCells, nCells / best * 1e-6, double(M.nTriangles()) / best * 1e-6);
+		bench_report(name, best);
+	}
+}
+
+// A ball of radius n/8 in grids of n^3 to (4n)^3: the dense volume at n^3,
+// the sparse volume at all three. The ball and its surface stay the same, so
+// should memory and extraction time of the sparse volume, which is built from
+// the field directly (the build itself evaluates the whole grid).
+inline void bench_sparse(int n) {
+	printf("sparse volume, ball of radius %d (iso=0.50)\n", n / 8);
+	const vec3f center(0.3f * float(n), 0.3f * float(n), 0.3f * float(n));
+	const float radius = float(n / 8);
+	thread_pool pool;
+	mesh M;
+	char name[128];
+	{
+		volume V;
+		ball_field(n, center, radius).fill(V, &pool);
+		MarchingCubes MC(V);
+		timer t;
+		MC.compute(0.5f, M);
+		snprintf(name, sizeof(name), "dense %d^3 [%zu triangles, %.1f MB]", n, M.nTriangles(), double(V.size() * sizeof(float) + MC.workspace_memory()) / double(1 << 20));
+		bench_report(name, t.query());
+	}
+	for (int g = n; g <= 4 * n; g *= 2) {
+		const sparse_volume S(ball_field(g, center, radius), 0.0f, 0.0f, &pool);
+		MarchingCubes MC(S);
+		timer t;
+		MC.compute(0.5f, M);
+		snprintf(name, sizeof(name), "sparse %d^3 [%zu triangles, %.1f MB, %zu leaves]", g, M.nTriangles(), double(S.memory() + MC.workspace_memory()) / double(1 << 20), S.leaves());
+		bench_report(name, t.query());
+	}
+}
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef __CONTOUR_SPECTRUM_H__
+#define __CONTOUR_SPECTRUM_H__
+
+#include<vector>
+#include<array>
+#include<cassert>
+#include<cmath>
+#include<inttypes.h>
+#include<algorithm>
+#include"MC_tables.h"
+#include"thread_pool.h"
+
+// Size of the isosurface for a whole sweep of isovalues, from one pass over
+// the cells: nSamples isovalues evenly spaced from the smallest to the largest
+// value, and for each of them the number of triangles, the surface area and
+// the volume enclosed by the surface (the part of the cells with value > isovalue).
+// A cell only contributes to the samples in its span [min,max) of corner values
+// (span-space binning): for these it adds the triangles of its case, the area
+// of the triangles with the vertices interpolated like MarchingCubes does, and
+// the fraction of the cell above the isovalue (estimated along its 12 edges).
+// Samples below its span see it as completely inside, which a difference array
+// counts with two updates per cell instead of one per sample.
+// The triangle counts are exact, the same as MarchingCubes::count(); area and
+// volume are in voxel units, the mesh is scaled by 2/max(dimension) (see
+// MarchingCubes::model_transform()), area by its square and volume by its cube.
+// The spectrum does not hold on to the data (see volume::build_spectrum()).
+class contour_spectrum {
+public:
+	struct sample {
+		float isovalue;
+		size_t triangles;
+		double area;
+		double volume;
+	};
+	inline contour_spectrum(const float* data, const std::array<int, 3>& dims, int nSamples = 256, thread_pool* pool = nullptr);
+	inline int size(void) const;								// number of samples
+	inline const sample& operator[](int n) const;				// samples ordered by isovalue
+	inline sample estimate(float isovalue) const;				// interpolated between the two nearest samples
+	inline size_t memory(void) const;							// bytes held
+protected:
+	struct sums {
+		std::vector<size_t> triangles;
+		std::vector<double> area;
+		std::vector<double> volume;
+		std::vector<int64_t> inside;							// difference array of fully inside cells
+	};
+	inline int first_at_least(float value) const;				// first sample with isovalue >= value, size() if none
+	inline void add_layer(const float* data, const std::array<int, 3>& dims, int z, sums& S) const;
+	std::vector<sample> m_samples;
+	float m_min, m_scale;										// sample of value v is about (v - m_min) * m_scale
+};
+
+inline contour_spectrum::contour_spectrum(const float* data, const std::array<int, 3>& dims, int nSamples, thread_pool* pool) : m_min(0.0f), m_scale(0.0f) {
+	assert("contour_spectrum -- invalid argument(s)" && nSamples > 0 && dims[0] >= 0 && dims[1] >= 0 && dims[2] >= 0);
+	const size_t n = size_t(dims[0]) * size_t(dims[1]) * size_t(dims[2]);
+	float vmax = 0.0f;
+	if (n > 0) {
+		auto range = std::minmax_element(data, data + n);
+		m_min = *range.first;
+		vmax = *range.second;
+	}
+	m_samples.resize(size_t(nSamples));
+	for (int j = 0; j < nSamples; j++) {
+		float t = nSamples > 1 ? float(j) / float(nSamples - 1) : 0.0f;
+		m_samples[j] = { m_min + t * (vmax - m_min), 0, 0.0, 0.0 };
+	}
+	m_scale = vmax > m_min && nSamples > 1 ? float(nSamples - 1) / (vmax - m_min) : 0.0f;
+	if (dims[0] < 2 || dims[1] < 2 || dims[2] < 2) return;
+
+	// one set of sums per worker, layers of cells as tasks, summed up at the end
+	const int nWorkers = pool ? pool->size() : 1;
+	std::vector<sums> partial((size_t(nWorkers)));
+	for (sums& S : partial) {
+		S.triangles.assign(size_t(nSamples), 0);
+		S.area.assign(size_t(nSamples), 0.0);
+		S.volume.assign(size_t(nSamples), 0.0);
+		S.inside.assign(size_t(nSamples) + 1, 0);
+	}
+	if (pool) pool->run(size_t(dims[2] - 1), [&](size_t z, int worker) { add_layer(data, dims, int(z), partial[worker]); });
+	else for (int z = 0; z < dims[2] - 1; z++) add_layer(data, dims, z, partial[0]);
+
+	int64_t inside = 0;
+	for (int j = 0; j < nSamples; j++) {
+		sample& s = m_samples[j];
+		for (const sums& S : partial) {
+			s.triangles += S.triangles[j];
+			s.area += S.area[j];
+			s.volume += S.volume[j];
+			inside += S.inside[j];
+		}
+		s.volume += double(inside);
+	}
+}
+
+inline int contour_spectrum::size(void) const {
+	return int(m_samples.size());
+}
+
+inline const contour_spectrum::sample& contour_spectrum::operator[](int n) const {
+	assert("contour_spectrum[] -- invalid argument" && n >= 0 && n < size());
+	return m_samples[n];
+}
+
+inline contour_spectrum::sample contour_spectrum::estimate(float isovalue) const {
+	if (!(isovalue > m_samples.front().isovalue)) return m_samples.front();
+	if (!(isovalue < m_samples.back().isovalue)) return m_samples.back();
+	int j = std::max(first_at_least(isovalue), 1);
+	const sample& a = m_samples[j - 1];
+	const sample& b = m_samples[j];
+	double t = b.isovalue > a.isovalue ? double(isovalue - a.isovalue) / double(b.isovalue - a.isovalue) : 0.0;
+	sample result;
+	result.isovalue = isovalue;
+	result.triangles = size_t(std::llround((1.0 - t) * double(a.triangles) + t * double(b.triangles)));
+	result.area = (1.0 - t) * a.area + t * b.area;
+	result.volume = (1.0 - t) * a.volume + t * b.volume;
+	return result;
+}
+
+inline size_t contour_spectrum::memory(void) const {
+	return m_samples.capacity() * sizeof(sample);
+}
+
+inline int contour_spectrum::first_at_least(float value) const {
+	// the guess from the spacing is off by at most one sample for rounding,
+	// the comparisons with the stored isovalues make the answer exact
+	const int nSamples = size();
+	float guess = std::ceil((value - m_min) * m_scale);
+	int j = guess > 0.0f ? (guess < float(nSamples) ? int(guess) : nSamples) : 0;
+	while (j > 0 && m_samples[j - 1].isovalue >= value) j--;
+	while (j < nSamples && m_samples[j].isovalue < value) j++;
+	return j;
+}
+
+inline void contour_spectrum::add_layer(const float* data, const std::array<int, 3>& dims, int z, sums& S) const {
+	const size_t stride[3] = { 1, size_t(dims[0]), size_t(dims[0]) * size_t(dims[1]) };
+	size_t corner_offset[8];
+	for (int c = 0; c < 8; c++) corner_offset[c] = mc_corner[c][0] * stride[0] + mc_corner[c][1] * stride[1] + mc_corner[c][2] * stride[2];
+	for (int y = 0; y < dims[1] - 1; y++) {
+		const float* row = data + size_t(y) * stride[1] + size_t(z) * stride[2];
+		for (int x = 0; x < dims[0] - 1; x++) {
+			float v[8];
+			for (int c = 0; c < 8; c++) v[c] = row[x + corner_offset[c]];
+			float cmin = v[0], cmax = v[0];
+			for (int c = 1; c < 8; c++) {
+				cmin = std::min(cmin, v[c]);
+				cmax = std::max(cmax, v[c]);
+			}
+			if (std::isnan(cmin) || std::isnan(cmax)) continue;
+			// all corners are above the samples before first, the cell is cut by
+			// the samples in [first,last) and lies below the samples from last on
+			const int first = first_at_least(cmin);
+			const int last = first_at_least(cmax);
+			S.inside[0]++;
+			S.inside[first]--;
+			for (int j = first; j < last; j++) {
+				const float isovalue = m_samples[j].isovalue;
+				int code = 0;
+				for (int c = 0; c < 8; c++) code |= (v[c] > isovalue) << c;
+				const mc_case& C = mc_cases[code];
+
+				// vertices on the cut edges, and the part of each edge above the isovalue
+				float p[12][3];
+				double above = 0.0;
+				for (int e = 0, k = 0; e < 12; e++) {
+					const int a = mc_edge_corner[e][0], b = mc_edge_corner[e][1];
+					const bool in_a = v[a] > isovalue, in_b = v[b] > isovalue;
+					if (in_a == in_b) {
+						above += in_a ? 1.0 : 0.0;
+						continue;
+					}
+					const float t = (isovalue - v[a]) / (v[b] - v[a]);
+					above += in_a ? t : 1.0f - t;
+					assert("contour_spectrum::add_layer() -- edges out of order" && k < C.nEdges && C.edge[k] == e);
+					for (int i = 0; i < 3; i++) p[k][i] = float(mc_corner[a][i]) + t * float(mc_corner[b][i] - mc_corner[a][i]);
+					k++;
+				}
+				double area = 0.0;
+				for (int n = 0; n < C.nTriangles; n++) {
+					const float* p0 = p[C.triangle[3 * n]];
+					const float* p1 = p[C.triangle[3 * n + 1]];
+					const float* p2 = p[C.triangle[3 * n + 2]];
+					const float u[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+					const float w[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+					const float c[3] = { u[1] * w[2] - u[2] * w[1], u[2] * w[0] - u[0] * w[2], u[0] * w[1] - u[1] * w[0] };
+					area += 0.5 * std::sqrt(double(c[0]) * c[0] + double(c[1]) * c[1] + double(c[2]) * c[2]);
+				}
+				S.triangles[j] += size_t(C.nTriangles);
+				S.area[j] += area;
+				S.volume[j] += above / 12.0;
+			}
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,319 @@
+#ifndef __EDGE_MAP_H__
+#define __EDGE_MAP_H__
+
+#include<vector>
+#include<cassert>
+#include<inttypes.h>
+#include<algorithm>
+#include<atomic>
+#include<memory>
+#include<thread>
+#include"page_allocator.h"
+
+// Maps from edge ids (see MarchingCubes::edge_id()) to vertex ids of the mesh
+// under construction. Both variants share the same interface, so that the
+// extraction loop can be instantiated with either one:
+//   find(id)           RETURNS vertex id of edge id, or -1 if there is none
+//   insert(id,vertex)  stores vertex for edge id, id must not be present yet
+//   find_or_insert(id,create)  RETURNS vertex id of edge id, if there is none
+//                      yet, stores and returns the vertex id that create() returns
+//   clear()            forgets all entries, but keeps the memory for the next extraction
+//   release()          forgets all entries and frees the memory
+//   memory()           bytes currently held
+// The tables come from page_allocator, so large ones get huge pages.
+
+// One int per edge of the volume, 3 edges per voxel. Lookups are a single
+// load, but the table is 12 bytes per voxel no matter how small the surface.
+class dense_edge_map {
+public:
+	inline void resize(size_t nEdges);							// prepare for edge ids in [0,nEdges)
+	inline int find(size_t id) const;
+	inline void insert(size_t id, int vertex);
+	template<class F>
+	inline int find_or_insert(size_t id, F create);
+	inline void clear(void);
+	inline void release(void);
+	inline size_t memory(void) const;
+protected:
+	std::vector<int, page_allocator<int>> m_table;				// vertex per edge id, -1 if none
+	std::vector<size_t> m_used;									// ids set since the last clear()
+};
+
+// Open addressing hash table with linear probing. Memory is proportional to
+// the number of active edges: the capacity is a power of two and kept at
+// least twice the number of entries.
+class sparse_edge_map {
+public:
+	inline sparse_edge_map(void);
+	inline void reserve(size_t n);								// make room for n entries without growing
+	inline int find(size_t id) const;
+	inline void insert(size_t id, int vertex);
+	template<class F>
+	inline int find_or_insert(size_t id, F create);
+	inline void erase(size_t id);								// removes id if present
+	inline void clear(void);
+	inline void release(void);
+	inline size_t memory(void) const;
+	inline size_t size(void) const;								// number of entries
+protected:
+	static constexpr const size_t EMPTY = ~size_t(0);
+	struct entry {
+		size_t id;
+		int vertex;
+	};
+	inline size_t slot(size_t id) const;						// home slot of id
+	inline void rehash(size_t capacity);
+	std::vector<entry, page_allocator<entry>> m_table;
+	size_t m_size;
+	int m_shift;												// 64 - log2(capacity)
+};
+
+// Open addressing with linear probing like sparse_edge_map, but safe to use
+// from many threads at once. Only find_or_insert() is available: the slot of
+// a new id is claimed with a compare-and-swap, so of all threads that meet the
+// same edge exactly one calls create(), the others wait until it has published
+// the vertex id. The capacity is fixed by reserve() before the threads start,
+// there is no rehashing and no erase; reserve(), clear() and release() must
+// not run concurrently with anything else.
+class concurrent_edge_map {
+public:
+	inline concurrent_edge_map(void);
+	inline ~concurrent_edge_map(void);
+	inline void reserve(size_t n);								// room for n entries
+	template<class F>
+	inline int find_or_insert(size_t id, F create);				// thread safe
+	inline void clear(void);
+	inline void release(void);
+	inline size_t memory(void) const;
+protected:
+	static constexpr const size_t EMPTY = ~size_t(0);
+	static constexpr const int PENDING = -1;					// slot claimed, vertex not published yet
+	struct entry {
+		std::atomic<size_t> id;
+		std::atomic<int> vertex;
+	};
+	inline size_t slot(size_t id) const;
+	entry* m_table;
+	size_t m_capacity;
+	int m_shift;
+private:
+	concurrent_edge_map(const concurrent_edge_map&);			// not copyable, owns m_table
+};
+
+inline void dense_edge_map::resize(size_t nEdges) {
+	if (m_table.size() == nEdges) return clear();
+	release();
+	m_table.resize(nEdges, -1);
+}
+
+inline int dense_edge_map::find(size_t id) const {
+	assert("dense_edge_map::find() -- invalid argument" && id < m_table.size());
+	return m_table[id];
+}
+
+inline void dense_edge_map::insert(size_t id, int vertex) {
+	assert("dense_edge_map::insert() -- invalid argument" && id < m_table.size() && m_table[id] == -1);
+	m_table[id] = vertex;
+	m_used.push_back(id);
+}
+
+template<class F>
+inline int dense_edge_map::find_or_insert(size_t id, F create) {
+	int vertex = find(id);
+	if (vertex == -1) {
+		vertex = create();
+		insert(id, vertex);
+	}
+	return vertex;
+}
+
+inline void dense_edge_map::clear(void) {
+	// undo exactly the entries that were set, the rest of the table is still -1
+	for (size_t id : m_used) m_table[id] = -1;
+	m_used.clear();
+}
+
+inline void dense_edge_map::release(void) {
+	decltype(m_table)().swap(m_table);
+	std::vector<size_t>().swap(m_used);
+}
+
+inline size_t dense_edge_map::memory(void) const {
+	return m_table.capacity() * sizeof(int) + m_used.capacity() * sizeof(size_t);
+}
+
+inline sparse_edge_map::sparse_edge_map(void) : m_size(0), m_shift(64) {
+}
+
+inline void sparse_edge_map::reserve(size_t n) {
+	size_t capacity = 16;
+	while (capacity < 2 * n) capacity *= 2;
+	if (capacity > m_table.size()) rehash(capacity);
+}
+
+inline size_t sparse_edge_map::slot(size_t id) const {
+	// Fibonacci hashing, the top bits of the product are well mixed
+	return size_t((uint64_t(id) * 0x9E3779B97F4A7C15ull) >> m_shift);
+}
+
+inline int sparse_edge_map::find(size_t id) const {
+	if (m_table.empty()) return -1;
+	const size_t mask = m_table.size() - 1;
+	for (size_t n = slot(id);; n = (n + 1) & mask) {
+		if (m_table[n].id == id) return m_table[n].vertex;
+		if (m_table[n].id == EMPTY) return -1;
+	}
+}
+
+inline void sparse_edge_map::insert(size_t id, int vertex) {
+	assert("sparse_edge_map::insert() -- invalid argument" && id != EMPTY && find(id) == -1);
+	if (2 * (m_size + 1) > m_table.size()) rehash(std::max<size_t>(16, 2 * m_table.size()));
+	const size_t mask = m_table.size() - 1;
+	size_t n = slot(id);
+	while (m_table[n].id != EMPTY) n = (n + 1) & mask;
+	m_table[n].id = id;
+	m_table[n].vertex = vertex;
+	m_size++;
+}
+
+template<class F>
+inline int sparse_edge_map::find_or_insert(size_t id, F create) {
+	int vertex = find(id);
+	if (vertex == -1) {
+		vertex = create();
+		insert(id, vertex);
+	}
+	return vertex;
+}
+
+inline void sparse_edge_map::erase(size_t id) {
+	if (m_table.empty()) return;
+	const size_t mask = m_table.size() - 1;
+	size_t hole = slot(id);
+	while (m_table[hole].id != id) {
+		if (m_table[hole].id == EMPTY) return;
+		hole = (hole + 1) & mask;
+	}
+	// backward shift deletion: move later entries of the probe sequence into
+	// the hole as long as that does not put them in front of their home slot
+	for (size_t n = (hole + 1) & mask; m_table[n].id != EMPTY; n = (n + 1) & mask) {
+		size_t home = slot(m_table[n].id);
+		if (((n - home) & mask) >= ((n - hole) & mask)) {
+			m_table[hole] = m_table[n];
+			hole = n;
+		}
+	}
+	m_table[hole].id = EMPTY;
+	m_size--;
+}
+
+inline void sparse_edge_map::clear(void) {
+	if (m_size == 0) return;
+	for (entry& e : m_table) e.id = EMPTY;
+	m_size = 0;
+}
+
+inline void sparse_edge_map::release(void) {
+	decltype(m_table)().swap(m_table);
+	m_size = 0;
+	m_shift = 64;
+}
+
+inline size_t sparse_edge_map::memory(void) const {
+	return m_table.capacity() * sizeof(entry);
+}
+
+inline size_t sparse_edge_map::size(void) const {
+	return m_size;
+}
+
+inline void sparse_edge_map::rehash(size_t capacity) {
+	assert("sparse_edge_map::rehash() -- capacity must be a power of two" && (capacity & (capacity - 1)) == 0);
+	decltype(m_table) old;
+	old.swap(m_table);
+	m_table.resize(capacity, entry{ EMPTY, -1 });
+	m_shift = 64;
+	while (capacity > 1) {
+		capacity >>= 1;
+		m_shift--;
+	}
+	m_size = 0;
+	for (const entry& e : old) {
+		if (e.id != EMPTY) insert(e.id, e.vertex);
+	}
+}
+
+inline concurrent_edge_map::concurrent_edge_map(void) : m_table(nullptr), m_capacity(0), m_shift(64) {
+}
+
+inline concurrent_edge_map::~concurrent_edge_map(void) {
+	release();
+}
+
+inline void concurrent_edge_map::reserve(size_t n) {
+	size_t capacity = 16;
+	while (capacity < 2 * n) capacity *= 2;
+	if (capacity > m_capacity) {
+		release();
+		m_table = page_allocator<entry>().allocate(capacity);
+		std::uninitialized_default_construct_n(m_table, capacity);
+		m_capacity = capacity;
+		m_shift = 64;
+		while (capacity > 1) {
+			capacity >>= 1;
+			m_shift--;
+		}
+	}
+	clear();
+}
+
+inline size_t concurrent_edge_map::slot(size_t id) const {
+	// Fibonacci hashing, see sparse_edge_map::slot()
+	return size_t((uint64_t(id) * 0x9E3779B97F4A7C15ull) >> m_shift);
+}
+
+template<class F>
+inline int concurrent_edge_map::find_or_insert(size_t id, F create) {
+	assert("concurrent_edge_map::find_or_insert() -- invalid argument" && id != EMPTY && m_capacity > 0);
+	const size_t mask = m_capacity - 1;
+	size_t n = slot(id);
+	for (size_t probes = 0; probes < m_capacity; probes++, n = (n + 1) & mask) {
+		entry& e = m_table[n];
+		size_t current = e.id.load(std::memory_order_acquire);
+		if (current == EMPTY) {
+			if (e.id.compare_exchange_strong(current, id, std::memory_order_acq_rel)) {
+				int vertex = create();
+				e.vertex.store(vertex, std::memory_order_release);
+				return vertex;
+			}
+			// another thread took the slot, current now holds its id
+		}
+		if (current == id) {
+			int vertex;
+			while ((vertex = e.vertex.load(std::memory_order_acquire)) == PENDING) std::this_thread::yield();
+			return vertex;
+		}
+	}
+	assert("concurrent_edge_map::find_or_insert() -- table is full" && false);
+	return -1;
+}
+
+inline void concurrent_edge_map::clear(void) {
+	for (size_t n = 0; n < m_capacity; n++) {
+		m_table[n].id.store(EMPTY, std::memory_order_relaxed);
+		m_table[n].vertex.store(PENDING, std::memory_order_relaxed);
+	}
+}
+
+inline void concurrent_edge_map::release(void) {
+	if (m_table) page_allocator<entry>().deallocate(m_table, m_capacity);
+	m_table = nullptr;
+	m_capacity = 0;
+	m_shift = 64;
+}
+
+inline size_t concurrent_edge_map::memory(void) const {
+	return m_capacity * sizeof(entry);
+}
+
+#endif
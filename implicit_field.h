@@ -0,0 +1,87 @@
+#ifndef __IMPLICIT_FIELD_H__
+#define __IMPLICIT_FIELD_H__
+
+#include<array>
+#include<cassert>
+#include<functional>
+#include<algorithm>
+#include"volume.h"
+#include"thread_pool.h"
+
+// A volume given by a function instead of voxels: value(x,y,z) = f(x,y,z) on
+// the grid points 0..dimension(i)-1, x,y,z passed as floats in voxel units.
+// Nothing is stored, MarchingCubes(const implicit_field&) evaluates the slabs
+// it is about to extract and forgets them again, so grids far larger than
+// memory can be meshed; fill() samples it into a volume instead.
+// Values are produced a row at a time: f is inlined into a loop over LANES
+// x-coordinates that the compiler turns into SIMD code where f allows it
+// (arithmetic, sqrt, min/max; calls into the math library usually stay scalar).
+// Only the row function is called through std::function, once per row.
+// f has to be safe to call from several threads at once.
+class implicit_field {
+public:
+	static constexpr const int LANES = 16;						// x-coordinates per batch
+	template<class F>
+	inline implicit_field(int dimx, int dimy, int dimz, F f);
+	inline size_t dimension(size_t n) const;					// number of grid points along axis n
+	inline size_t size(void) const;								// total number of grid points
+	inline bool empty(void) const;
+	inline void evaluate_row(int y, int z, float* row) const;	// dimension(0) values of row (y,z)
+	inline void evaluate(int z0, int z1, float* slab, thread_pool* pool = nullptr) const;	// slices z0..z1-1, x fastest, a task per slice
+	inline void fill(volume& V, thread_pool* pool = nullptr) const;	// resizes V and samples the whole grid
+protected:
+	std::array<int, 3> m_dims;
+	std::function<void(int, int, float*)> m_row;
+};
+
+template<class F>
+inline implicit_field::implicit_field(int dimx, int dimy, int dimz, F f) : m_dims({ dimx,dimy,dimz }) {
+	assert("implicit_field -- invalid argument(s)" && dimx >= 0 && dimy >= 0 && dimz >= 0);
+	const int n = dimx;
+	m_row = [f, n](int y, int z, float* row) {
+		const float fy = float(y), fz = float(z);
+		int x = 0;
+		for (; x + LANES <= n; x += LANES) {
+			// fixed trip count, independent lanes
+			for (int k = 0; k < LANES; k++) row[x + k] = f(float(x + k), fy, fz);
+		}
+		for (; x < n; x++) row[x] = f(float(x), fy, fz);
+	};
+}
+
+inline size_t implicit_field::dimension(size_t n) const {
+	assert("implicit_field::dimension() -- invalid argument" && n < 3);
+	return m_dims[n];
+}
+
+inline size_t implicit_field::size(void) const {
+	return size_t(m_dims[0]) * size_t(m_dims[1]) * size_t(m_dims[2]);
+}
+
+inline bool implicit_field::empty(void) const {
+	return size() == 0;
+}
+
+inline void implicit_field::evaluate_row(int y, int z, float* row) const {
+	assert("implicit_field::evaluate_row() -- invalid argument(s)" && y >= 0 && y < m_dims[1] && z >= 0 && z < m_dims[2]);
+	m_row(y, z, row);
+}
+
+inline void implicit_field::evaluate(int z0, int z1, float* slab, thread_pool* pool) const {
+	assert("implicit_field::evaluate() -- invalid argument(s)" && z0 >= 0 && z0 <= z1 && z1 <= m_dims[2]);
+	const size_t slice = size_t(m_dims[0]) * size_t(m_dims[1]);
+	auto task = [&](size_t s, int) {
+		float* v = slab + s * slice;
+		for (int y = 0; y < m_dims[1]; y++) m_row(y, z0 + int(s), v + size_t(y) * size_t(m_dims[0]));
+	};
+	if (pool) pool->run(size_t(z1 - z0), task);
+	else for (size_t s = 0; s < size_t(z1 - z0); s++) task(s, 0);
+}
+
+inline void implicit_field::fill(volume& V, thread_pool* pool) const {
+	V.resize(m_dims[0], m_dims[1], m_dims[2]);
+	if (V.empty()) return;
+	evaluate(0, m_dims[2], &V[0], pool);
+}
+
+#endif
@@ -12,7 +12,9 @@ extern "C" {
 // Selman Tabet (@selmantabet - https://selman.io/) - Implementation of the Marching Cubes Algorithm (HBKU DataVis Course Assignment)
 // MyVolume variable in the init function can take a .dat file (volume dataset). Modify as deemed necessary.
 // Press the plus (+) key to increase the isovalue and the minus (-) key to decrease it.
+// Run with --bench [dims] [simd] to run the benchmarks in benchmark.h instead of the viewer.
 #include<iostream>
+#include<string>
 #include"timer.h"
 #include<vector>
 #include"ext_math.h"
@@ -25,19 +27,25 @@ extern "C" {
 // To do so, we're including a volume class (see file volume.h)
 #include"volume.h"
 
+#include"implicit_field.h"
+
+// The test function as a field, for MarchingCubes to evaluate slab by slab
+// (see implicit_field). generate_radial_volume() samples it into a volume.
+implicit_field radial_field(int dims = 128) {
+	const float scale = 2.0f / float(dims - 1);
+	return implicit_field(dims, dims, dims, [scale](float i, float j, float k) {
+		float x = scale * i - 1.0f;
+		float y = scale * j - 1.0f;
+		float z = scale * k - 1.0f;
+		// normalize to 0,1, denser material inside...
+		return 1.0f - std::sqrt(x * x + y * y + z * z) / std::sqrt(3.0f);
+	});
+}
+
 volume generate_radial_volume(int dims = 128) {
-	volume vol(dims, dims, dims);
-	for (int k = 0; k < vol.dimension(2); k++) {
-		float z = 2.0f * float(k) / (vol.dimension(2) - 1) - 1.0f;
-		for (int j = 0; j < vol.dimension(1); j++) {
-			float y = 2.0f * float(j) / (vol.dimension(1) - 1) - 1.0f;
-			for (int i = 0; i < vol.dimension(0); i++) {
-				float x = 2.0f * float(i) / (vol.dimension(0) - 1) - 1.0f;
-				// normalize to 0,1, denser material inside...
-				vol(i, j, k) = 1.0f-sqrt(x * x + y * y + z * z)/sqrt(3.0f);
-			}
-		}
-	}
+	volume vol;
+	thread_pool pool;	// a slice per task
+	radial_field(dims).fill(vol, &pool);
 	return vol;
 }
 
@@ -47,6 +55,7 @@ volume MyVolume;
 // Look at MC.h and MC.cpp.
 #include"MC.h"
 float isovalue = 0.2f;	// default isovalue
+MarchingCubes MyMC(MyVolume);	// keeps its workspace between isovalue changes
 
 // TASK:: [TODO] Some of the volumes you will be working with
 // are fairly large. In order to get a quick preview, implement
@@ -55,12 +64,46 @@ float isovalue = 0.2f;	// default isovalue
 
 // This is a shallow wrapper for a triangle mesh
 #include"mesh.h"
-mesh MyMesh; // This will be our triangle model
+const mesh& MyMesh = MyMC.surface(); // This will be our triangle model, patched in place by MyMC.update()
+
+#include"benchmark.h"
+
+#ifdef MC_COUNT_ALLOCATIONS
+#include<cstdlib>
+#include<new>
+// Counts the heap allocations of the program for bench_allocations(), only in
+// a build with MC_COUNT_ALLOCATIONS defined, the viewer keeps the library's
+// allocator. The array and aligned forms end up here or in the library's
+// versions, which pair up with its own delete. GCC takes free() on memory
+// from operator new for a mismatch, it is the replacement's own pair here.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void* operator new(size_t size) {
+	bench_heap_allocations().fetch_add(1, std::memory_order_relaxed);
+	if (void* p = malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
 
 int winwidth = 512;
 int winheight = 512;
 
 timer myTimer;
+timer lastUpdate;	// MyMC.refresh() once the isovalue rests for half a second, see update()
+bool refreshed = true;
 
 void display(void) {
 	// This function will be called to generate a new frame
@@ -69,6 +112,11 @@ void display(void) {
 	glLoadIdentity();	
 	glTranslatef(0.0f, 0.0f, -2.0f);
 	glRotatef(60.0f * (float)myTimer.query(), 0.0f, 1.0f, 0.0f);
+	if (!refreshed && lastUpdate.query() > 0.5) {
+		// update() only moves the vertices near the voxels that changed sides
+		MyMC.refresh();
+		refreshed = true;
+	}
 	
 	// Beware, deprecated, slow OpenGL
 	glBegin(GL_TRIANGLES);
@@ -85,6 +133,14 @@ void display(void) {
 	glutSwapBuffers();											// Show rendered image
 }
 
+void print_expected(float iso) {
+	// from the contour spectrum, before the extraction starts
+	const contour_spectrum* S = MyVolume.spectrum();
+	if (!S) return;
+	contour_spectrum::sample s = S->estimate(iso);
+	printf("isovalue %.2f: about %zu triangles, area %.1f, enclosed volume %.0f voxels\n", iso, s.triangles, s.area, s.volume);
+}
+
 void keyboard(unsigned char key, int x, int y) {
 	// key will contain the key that was pressed
 	// x,y are the mouse coordinates when the key was pressed.	
@@ -92,15 +148,19 @@ void keyboard(unsigned char key, int x, int y) {
 	case '-':
 	{
 		isovalue = std::max(isovalue - 0.05f, 0.0f);
-		MarchingCubes MC(MyVolume);
-		MyMesh = MC.compute(isovalue);
+		print_expected(isovalue);
+		MyMC.update(isovalue);
+		lastUpdate.reset();
+		refreshed = false;
 		break;
 	}
 	case '+':
 	{
 		isovalue = std::min(isovalue + 0.05f, 1.0f);
-		MarchingCubes MC(MyVolume);
-		MyMesh = MC.compute(isovalue);
+		print_expected(isovalue);
+		MyMC.update(isovalue);
+		lastUpdate.reset();
+		refreshed = false;
 		break;
 	}
 	}
@@ -156,8 +216,9 @@ void init(void) {
 	MyVolume = generate_radial_volume(64);
 	//MyVolume.import_dat("stagbeetle832x832x494.dat");
 	MyVolume.subsample();
-	MarchingCubes MC(MyVolume);
-	MyMesh = MC.compute(isovalue);
+	MyVolume.build_index();	// lets MyMC.update() re-tag only the voxels between two isovalues
+	MyVolume.build_spectrum();	// mesh sizes for all isovalues, see print_expected()
+	MyMC.update(isovalue);
 	MyMesh.export_obj("latest.obj");
 	
 	// NOW, set up fixed function lighting... meh.
@@ -179,7 +240,46 @@ void cleanup(void) {
 
 
 
+int run_benchmarks(int argc, char** argv) {
+	// usage: Assignment2 --bench [dims] [scalar|sse2|avx2|avx512]
+	int dims = argc > 2 ? atoi(argv[2]) : 256;
+	volume V = generate_radial_volume(dims);
+	MarchingCubes MC(V);
+	if (argc > 3) {
+		// force a kernel variant for all benchmarks, if the CPU supports it
+		const char* names[] = { "scalar", "sse2", "avx2", "avx512" };
+		for (int level = SIMD_SCALAR; level <= SIMD_AVX512; level++) {
+			if (std::string(argv[3]) == names[level]) MC.set_simd(simd_level(level));
+		}
+	}
+	printf("SIMD kernels: %s\n", simd_name(MC.simd()));
+	bench_cells(V, MC, 0.5f);
+	bench_count(MC, 0.5f);
+	bench_spectrum(V, MC, 0.5f);
+	bench_propagation(MC, 0.5f);
+	bench_propagation(MC, 0.9f);
+	bench_components(V, 0.5f);
+	bench_region(V, MC, 0.5f);
+	bench_views(V, 0.5f);
+	bench_field(radial_field(2 * dims), 0.5f);
+	bench_synthetic(dims);
+	bench_sparse(dims);
+	bench_simd(V, MC, 0.5f);
+	bench_threads(V, MC, 0.5f);
+	bench_parallel_modes(V, MC, 0.5f);
+	bench_numa(V, MC, 0.5f);
+	bench_huge_pages(V, MC, 0.5f);
+	bench_ownership(V, MC, 0.5f);
+	bench_edge_maps(MC, 0.5f);
+	bench_allocations(MC, 0.5f);
+	bench_incremental(V, MC, 0.5f, 0.05f);
+	V.build_index();
+	bench_incremental(V, MC, 0.5f, 0.05f);
+	return 0;
+}
+
 int main(int argc, char** argv) {
+	if (argc > 1 && std::string(argv[1]) == "--bench") return run_benchmarks(argc, argv);
 	atexit(cleanup);											// This makes sure that you call cleanup() before exiting
 	std::cout << "CPEG 418 Assignment 2" << std::endl;
 	glutInit(&argc, argv);										// Initialize GLUT
@@ -2,28 +2,40 @@
 #define __MESH_H__
 
 #include<vector>
+#include<utility>
 #include"ext_math.h"
 #include<cassert>
 #include<fstream>
 #include<inttypes.h>
 #include<algorithm>
+#include"arena.h"
 
 // This here is a simple class to store a triangle mesh.
 // A triangle mesh contains a list of 3D positions (vertices)
 // and a list of triangles (triples of vertex ids)
+// A mesh can live in an arena (see arena.h), it then allocates nothing from
+// the heap and has to be done with before the arena is reset.
 class mesh {
 public:
 	// Here, a vertes should have a position, a normal, and a color.
 	inline mesh(void);								// default constructor
-	inline mesh(const mesh& other);					// copy constructor
+	inline explicit mesh(arena* storage);			// storage from the arena, the default is the heap
+	inline explicit mesh(const mesh& other);		// copy constructor, deep copies have to be asked for
+	inline mesh(mesh&& other) noexcept;				// move constructor, takes over the storage of other
 	inline ~mesh(void);								// default destructor
-	inline mesh& operator=(const mesh& other);		// assignment operator
+	inline mesh& operator=(mesh&& other) noexcept;	// move assignment, other is left empty
+	inline mesh& copy_from(const mesh& other);		// deep copy, keeps the storage of this mesh
 	inline int add_vertex(const vec3f& position,	// add a vertex consisting of position and optionally normal and color
 		const vec3f& normal=vec3f(0.0f,0.0f,0.0f),	// RETURNS: vertex ID.
 		const vec3f& color=vec3f(1.0f,1.0f,1.0f));
 	inline int add_triangle(const vec3i& triangle);	// add a triangle i,j,k to the mesh. RETURNS triangle ID
 	inline bool empty(void) const;					// true iff mesh has no triangles and no vertices
 	inline void clear(void);						// empties the mesh
+	inline void reserve(size_t nVertices, size_t nTriangles);	// pre-allocates storage
+	inline void resize(size_t nVertices, size_t nTriangles);	// sets the sizes, for filling in parallel through position() etc.
+	template<class F>
+	inline size_t keep_triangles(F keep);			// removes triangle t unless keep(t), then the vertices no triangle uses,
+													// compacting in place, order kept. RETURNS number of triangles removed
 
 	inline size_t nTriangles(void) const;			// returns number of triangleS
 	inline size_t nVertices(void) const;			// returns number of vertices
@@ -43,26 +55,59 @@ public:
 	inline const vec3f* color_data(void) const;		// return color data pointer
 	inline const vec3i* triangle_data(void) const;	// return triangle data pointer
 
+	inline arena* storage(void) const;				// nullptr for the heap
+
 	inline bool export_obj(const std::string& name) const;	// export the mesh as obj file for meshlab
 protected:
-	std::vector<vec3f>	m_position;					// actual storage of positions
-	std::vector<vec3f>	m_normal;					// actual storage of normals
-	std::vector<vec3f>	m_color;					// actual storage of colors
-	std::vector<vec3i>	m_triangle;					// actual storage of triangles
+	std::vector<vec3f, arena_allocator<vec3f>>	m_position;	// actual storage of positions
+	std::vector<vec3f, arena_allocator<vec3f>>	m_normal;	// actual storage of normals
+	std::vector<vec3f, arena_allocator<vec3f>>	m_color;	// actual storage of colors
+	std::vector<vec3i, arena_allocator<vec3i>>	m_triangle;	// actual storage of triangles
+private:
+	mesh& operator=(const mesh& other) = delete;	// no implicit deep copies, see copy_from()
+};
+
+// Describes how a mesh was changed in place, see MarchingCubes::update().
+// Triangle slots in removed hold a degenerate triangle now (all three indices
+// equal), slots in added hold a new or moved triangle. Every slot is listed
+// at most once and lies below mesh::nTriangles(); the slots from there on are
+// gone, e.g. after triangles were moved down to close free slots.
+// vertices lists all vertices that were added or moved.
+struct mesh_delta {
+	std::vector<int> removed;
+	std::vector<int> added;
+	std::vector<int> vertices;
+	inline void clear(void);
 };
 
+inline void mesh_delta::clear(void) {
+	removed.clear();
+	added.clear();
+	vertices.clear();
+}
+
 inline mesh::mesh(void) {
 }
 
+inline mesh::mesh(arena* storage) : m_position(storage), m_normal(storage), m_color(storage), m_triangle(storage) {
+}
+
 inline mesh::mesh(const mesh& other) {
-	*this = other;
+	copy_from(other);
+}
+
+inline mesh::mesh(mesh&& other) noexcept : m_position(std::move(other.m_position)), m_normal(std::move(other.m_normal)),
+	m_color(std::move(other.m_color)), m_triangle(std::move(other.m_triangle)) {
+	// takes over the arena of other as well
+	other.clear();
 }
 
 inline mesh::~mesh(void) {
 	clear();
 }
 
-inline mesh& mesh::operator=(const mesh& other) {
+inline mesh& mesh::copy_from(const mesh& other) {
+	if (this == &other) return *this;
 	if (other.empty()) {
 		clear();
 	}
@@ -75,6 +120,16 @@ inline mesh& mesh::operator=(const mesh& other) {
 	return *this;
 }
 
+inline mesh& mesh::operator=(mesh&& other) noexcept {
+	if (this == &other) return *this;
+	m_position = std::move(other.m_position);
+	m_normal = std::move(other.m_normal);
+	m_color = std::move(other.m_color);
+	m_triangle = std::move(other.m_triangle);
+	other.clear();
+	return *this;
+}
+
 inline int mesh::add_vertex(const vec3f& position, const vec3f& normal, const vec3f& color) {
 	int result = int(m_position.size());
 	m_position.push_back(position); 
@@ -99,6 +154,50 @@ inline void mesh::clear(void) {
 	m_triangle.clear();
 }
 
+inline void mesh::reserve(size_t nVertices, size_t nTriangles) {
+	m_position.reserve(nVertices);
+	m_normal.reserve(nVertices);
+	m_color.reserve(nVertices);
+	m_triangle.reserve(nTriangles);
+}
+
+inline void mesh::resize(size_t nVertices, size_t nTriangles) {
+	m_position.resize(nVertices);
+	m_normal.resize(nVertices);
+	m_color.resize(nVertices);
+	m_triangle.resize(nTriangles);
+}
+
+template<class F>
+inline size_t mesh::keep_triangles(F keep) {
+	// triangles move down over the removed ones, marking the vertices they use
+	std::vector<int> remap(m_position.size(), -1);
+	size_t nKept = 0;
+	for (size_t t = 0; t < m_triangle.size(); t++) {
+		if (!keep(int(t))) continue;
+		const vec3i& T = m_triangle[t];
+		for (int i = 0; i < 3; i++) remap[T[i]] = 0;
+		m_triangle[nKept++] = T;
+	}
+	const size_t removed = m_triangle.size() - nKept;
+	m_triangle.resize(nKept);
+	// then the used vertices, remap holds their new ids
+	int nUsed = 0;
+	for (size_t v = 0; v < m_position.size(); v++) {
+		if (remap[v] < 0) continue;
+		remap[v] = nUsed;
+		m_position[nUsed] = m_position[v];
+		m_normal[nUsed] = m_normal[v];
+		m_color[nUsed] = m_color[v];
+		nUsed++;
+	}
+	m_position.resize(size_t(nUsed));
+	m_normal.resize(size_t(nUsed));
+	m_color.resize(size_t(nUsed));
+	for (vec3i& T : m_triangle) T = vec3i(remap[T.x], remap[T.y], remap[T.z]);
+	return removed;
+}
+
 inline size_t mesh::nTriangles(void) const {
 	return m_triangle.size();
 }
@@ -147,6 +246,10 @@ inline vec3i& mesh::triangle(int n) {
 	return m_triangle[n];
 }
 
+inline arena* mesh::storage(void) const {
+	return m_position.get_allocator().storage;
+}
+
 inline const vec3f* mesh::position_data(void) const {
 	return m_position.data();
 }
@@ -172,10 +275,12 @@ inline bool mesh::export_obj(const std::string& name) const {
 		stream << "vn " << m_normal[n].x << " " << m_normal[n].y << " " << m_normal[n].z << std::endl;
 	}
 	for (size_t n = 0; n < m_triangle.size(); n++) {
+		if (m_triangle[n].x == m_triangle[n].y && m_triangle[n].y == m_triangle[n].z) continue; // free slot, see mesh_delta
 		stream << "f " << (m_triangle[n].x + 1) << "//" << (m_triangle[n].x + 1) << " "
 			<< (m_triangle[n].y + 1) << "//" << (m_triangle[n].y + 1) << " "
 			<< (m_triangle[n].z + 1) << "//" << (m_triangle[n].z + 1) << std::endl;
 	}
 	stream.close();
+	return true;
 }
 #endif
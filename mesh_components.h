@@ -0,0 +1,151 @@
+#ifndef __MESH_COMPONENTS_H__
+#define __MESH_COMPONENTS_H__
+
+#include<vector>
+#include<memory>
+#include<atomic>
+#include<cassert>
+#include<algorithm>
+#include"mesh.h"
+#include"thread_pool.h"
+
+// Connected components of a mesh: triangles that share a vertex belong to the
+// same component. The vertices are joined with a lock-free union-find, the
+// triangles are split into blocks of BLOCK that run as tasks of the pool:
+// roots are linked with a compare-and-swap, always the larger id below the
+// smaller, so concurrent unions cannot form a cycle, and find() halves the
+// paths it walks. Components are numbered by decreasing number of triangles,
+// component 0 is the largest.
+// Degenerate triangles (all three ids equal, the free slots of mesh_delta)
+// belong to no component and are removed by keep_largest() and drop_smaller(),
+// which compact the mesh in place (see mesh::keep_triangles()).
+// The labels refer to the mesh as it was passed in, label it again after
+// changing it.
+class mesh_components {
+public:
+	static constexpr const size_t BLOCK = size_t(1) << 16;		// triangles per task
+	static constexpr const int NONE = -1;
+	inline explicit mesh_components(const mesh& M, thread_pool* pool = nullptr);
+	inline int size(void) const;								// number of components
+	inline int component(int triangle) const;					// component of triangle, NONE if degenerate
+	inline size_t triangles(int component) const;				// number of triangles of component
+	inline size_t keep_largest(mesh& M, int n) const;			// keeps components 0..n-1. RETURNS triangles removed
+	inline size_t drop_smaller(mesh& M, size_t minTriangles) const;	// keeps components of at least minTriangles. RETURNS triangles removed
+	inline size_t memory(void) const;							// bytes held
+protected:
+	inline static int find(std::atomic<int>* parent, int v);
+	inline static void unite(std::atomic<int>* parent, int a, int b);
+	std::vector<int> m_component;								// per triangle
+	std::vector<size_t> m_triangles;							// per component, decreasing
+};
+
+inline int mesh_components::find(std::atomic<int>* parent, int v) {
+	for (;;) {
+		int p = parent[v].load(std::memory_order_relaxed);
+		if (p == v) return v;
+		int grandparent = parent[p].load(std::memory_order_relaxed);
+		if (grandparent == p) return p;
+		// path halving, losing the race only means the path stays longer
+		parent[v].compare_exchange_weak(p, grandparent, std::memory_order_relaxed);
+		v = grandparent;
+	}
+}
+
+inline void mesh_components::unite(std::atomic<int>* parent, int a, int b) {
+	for (;;) {
+		a = find(parent, a);
+		b = find(parent, b);
+		if (a == b) return;
+		if (a > b) std::swap(a, b);
+		// b is a root unless another thread linked it in the meantime, then retry
+		int expected = b;
+		if (parent[b].compare_exchange_strong(expected, a, std::memory_order_relaxed)) return;
+	}
+}
+
+inline mesh_components::mesh_components(const mesh& M, thread_pool* pool) {
+	const size_t nVertices = M.nVertices(), nTriangles = M.nTriangles();
+	const vec3i* triangle = M.triangle_data();
+	auto for_blocks = [&](size_t n, const auto& f) {
+		// f(first,last) on blocks of BLOCK items, on the pool if there is one
+		const size_t nBlocks = (n + BLOCK - 1) / BLOCK;
+		auto task = [&](size_t b, int) { f(b * BLOCK, std::min(n, (b + 1) * BLOCK)); };
+		if (pool) pool->run(nBlocks, task);
+		else for (size_t b = 0; b < nBlocks; b++) task(b, 0);
+	};
+
+	// 1. union-find over the vertices, one union per triangle edge
+	std::unique_ptr<std::atomic<int>[]> parent(new std::atomic<int>[nVertices]);
+	for_blocks(nVertices, [&](size_t first, size_t last) {
+		for (size_t v = first; v < last; v++) parent[v].store(int(v), std::memory_order_relaxed);
+	});
+	for_blocks(nTriangles, [&](size_t first, size_t last) {
+		for (size_t t = first; t < last; t++) {
+			const vec3i& T = triangle[t];
+			if (T.x == T.y && T.y == T.z) continue;
+			unite(parent.get(), T.x, T.y);
+			unite(parent.get(), T.x, T.z);
+		}
+	});
+
+	// 2. root of every triangle, triangles per root
+	m_component.resize(nTriangles);
+	for_blocks(nTriangles, [&](size_t first, size_t last) {
+		for (size_t t = first; t < last; t++) {
+			const vec3i& T = triangle[t];
+			m_component[t] = T.x == T.y && T.y == T.z ? NONE : find(parent.get(), T.x);
+		}
+	});
+	std::vector<size_t> count(nVertices, 0);
+	for (int root : m_component) {
+		if (root != NONE) count[root]++;
+	}
+
+	// 3. components by decreasing size, roots with equal sizes by id
+	std::vector<int> roots;
+	for (size_t v = 0; v < nVertices; v++) {
+		if (count[v] > 0) roots.push_back(int(v));
+	}
+	std::stable_sort(roots.begin(), roots.end(), [&](int a, int b) { return count[a] > count[b]; });
+	std::vector<int> rank(nVertices, NONE);
+	m_triangles.resize(roots.size());
+	for (size_t c = 0; c < roots.size(); c++) {
+		rank[roots[c]] = int(c);
+		m_triangles[c] = count[roots[c]];
+	}
+	for_blocks(nTriangles, [&](size_t first, size_t last) {
+		for (size_t t = first; t < last; t++) {
+			if (m_component[t] != NONE) m_component[t] = rank[m_component[t]];
+		}
+	});
+}
+
+inline int mesh_components::size(void) const {
+	return int(m_triangles.size());
+}
+
+inline int mesh_components::component(int triangle) const {
+	assert("mesh_components::component() -- invalid argument" && triangle >= 0 && size_t(triangle) < m_component.size());
+	return m_component[triangle];
+}
+
+inline size_t mesh_components::triangles(int component) const {
+	assert("mesh_components::triangles() -- invalid argument" && component >= 0 && component < size());
+	return m_triangles[component];
+}
+
+inline size_t mesh_components::keep_largest(mesh& M, int n) const {
+	assert("mesh_components::keep_largest() -- labels are of another mesh" && M.nTriangles() == m_component.size());
+	return M.keep_triangles([&](int t) { return m_component[t] != NONE && m_component[t] < n; });
+}
+
+inline size_t mesh_components::drop_smaller(mesh& M, size_t minTriangles) const {
+	assert("mesh_components::drop_smaller() -- labels are of another mesh" && M.nTriangles() == m_component.size());
+	return M.keep_triangles([&](int t) { return m_component[t] != NONE && m_triangles[m_component[t]] >= minTriangles; });
+}
+
+inline size_t mesh_components::memory(void) const {
+	return m_component.capacity() * sizeof(int) + m_triangles.capacity() * sizeof(size_t);
+}
+
+#endif
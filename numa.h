@@ -0,0 +1,217 @@
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+#include<cassert>
+#include<cstdio>
+#include<cstdint>
+#include<algorithm>
+#include<thread>
+#include<vector>
+
+#if defined(__linux__)
+#include<sched.h>
+#include<unistd.h>
+#include<sys/syscall.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include<windows.h>
+#endif
+
+// Placement of large arrays on the memory nodes of multi-socket machines.
+// Linux places a page on the node of the thread that touches it first, so
+// an array written by one thread ends up on one node and every other socket
+// reads it remotely. The volume and the tags are therefore first touched in
+// parallel, one contiguous block of z-slices per thread, and the extraction
+// threads are pinned to the same cpus, so thread t works on the slices that
+// live on its node (see numa_cpu(), volume::resize(), thread_pool).
+// On machines with a single node all of this is harmless: numa_nodes() is 1,
+// pinning is off by default and numa_place() only sets the default policy.
+enum numa_placement {
+	NUMA_FIRST_TOUCH,			// pages go to the node of the thread writing them first
+	NUMA_INTERLEAVED,			// pages round robin over all nodes
+	NUMA_SINGLE_NODE			// all pages on node 0, as if touched by a single thread
+};
+
+inline const char* numa_name(numa_placement placement);		// for printing
+inline int numa_nodes(void);								// number of memory nodes, 1 if unknown
+inline int numa_cpu(int slot, int nSlots);					// cpu of thread slot out of nSlots
+struct numa_affinity;
+inline bool numa_pin(int cpu, numa_affinity* previous = nullptr);	// pins the calling thread, saving its affinity in previous.
+																// RETURNS false if unsupported
+inline bool numa_unpin(const numa_affinity& previous);		// restores the affinity numa_pin() saved, e.g. a taskset mask
+inline bool numa_place(void* data, size_t bytes, numa_placement placement);	// policy for the untouched pages of data
+template<class F>
+inline void numa_for_slabs(size_t nSlabs, F f);				// f(first,last) per thread on pinned threads, contiguous blocks
+
+// cpus a thread may run on, as before numa_pin()
+struct numa_affinity {
+#if defined(__linux__)
+	cpu_set_t set;
+#elif defined(_WIN32)
+	DWORD_PTR mask;
+#endif
+	bool valid = false;
+};
+
+// cpus the process may use, node by node
+inline const std::vector<int>& numa_cpus(void) {
+	static const std::vector<int> cpus = [] {
+		std::vector<int> result;
+#if defined(__linux__)
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		bool masked = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+		for (int node = 0;; node++) {
+			char name[64];
+			snprintf(name, sizeof(name), "/sys/devices/system/node/node%d/cpulist", node);
+			FILE* file = fopen(name, "r");
+			if (!file) break;
+			// "0-15,32-47"
+			int first, last;
+			while (fscanf(file, "%d", &first) == 1) {
+				last = first;
+				int c = fgetc(file);
+				if (c == '-' && fscanf(file, "%d", &last) == 1) c = fgetc(file);
+				for (int cpu = first; cpu <= last; cpu++) {
+					if (!masked || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))) result.push_back(cpu);
+				}
+				if (c != ',') break;
+			}
+			fclose(file);
+		}
+		if (result.empty()) {
+			for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) if (masked && CPU_ISSET(cpu, &allowed)) result.push_back(cpu);
+		}
+#elif defined(_WIN32)
+		ULONG highest = 0;
+		if (GetNumaHighestNodeNumber(&highest)) {
+			for (UCHAR node = 0; node <= highest; node++) {
+				ULONGLONG mask = 0;
+				if (!GetNumaNodeProcessorMask(node, &mask)) continue;
+				for (int cpu = 0; cpu < 64; cpu++) if (mask & (ULONGLONG(1) << cpu)) result.push_back(cpu);
+			}
+		}
+#endif
+		if (result.empty()) {
+			for (int cpu = 0; cpu < int(std::max(std::thread::hardware_concurrency(), 1u)); cpu++) result.push_back(cpu);
+		}
+		return result;
+	}();
+	return cpus;
+}
+
+inline const char* numa_name(numa_placement placement) {
+	switch (placement) {
+	case NUMA_INTERLEAVED: return "interleaved";
+	case NUMA_SINGLE_NODE: return "single node";
+	default: return "first touch";
+	}
+}
+
+inline int numa_nodes(void) {
+	static const int nodes = [] {
+		int result = 0;
+#if defined(__linux__)
+		for (;; result++) {
+			char name[64];
+			snprintf(name, sizeof(name), "/sys/devices/system/node/node%d", result);
+			if (access(name, F_OK) != 0) break;
+		}
+#elif defined(_WIN32)
+		ULONG highest = 0;
+		if (GetNumaHighestNodeNumber(&highest)) result = int(highest) + 1;
+#endif
+		return std::max(result, 1);
+	}();
+	return nodes;
+}
+
+inline int numa_cpu(int slot, int nSlots) {
+	assert("numa_cpu() -- invalid argument(s)" && slot >= 0 && slot < nSlots);
+	// consecutive slots share a node, the slots are spread over all cpus
+	const std::vector<int>& cpus = numa_cpus();
+	return cpus[size_t(slot) * cpus.size() / size_t(nSlots)];
+}
+
+inline bool numa_pin(int cpu, numa_affinity* previous) {
+#if defined(__linux__)
+	if (previous) previous->valid = sched_getaffinity(0, sizeof(previous->set), &previous->set) == 0;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+	// SetThreadAffinityMask() returns the mask it replaced, 0 on failure
+	DWORD_PTR old = cpu < 64 ? SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) : 0;
+	if (previous) {
+		previous->mask = old;
+		previous->valid = old != 0;
+	}
+	return old != 0;
+#else
+	(void)cpu;
+	(void)previous;
+	return false;
+#endif
+}
+
+inline bool numa_unpin(const numa_affinity& previous) {
+	if (!previous.valid) return false;
+#if defined(__linux__)
+	return sched_setaffinity(0, sizeof(previous.set), &previous.set) == 0;
+#elif defined(_WIN32)
+	return SetThreadAffinityMask(GetCurrentThread(), previous.mask) != 0;
+#else
+	return false;
+#endif
+}
+
+inline bool numa_place(void* data, size_t bytes, numa_placement placement) {
+#if defined(__linux__) && defined(SYS_mbind)
+	// mbind() without libnuma. Only whole pages inside data are bound, the
+	// partial pages at the ends are shared with other allocations.
+	const uintptr_t page = uintptr_t(sysconf(_SC_PAGESIZE));
+	uintptr_t first = (uintptr_t(data) + page - 1) & ~(page - 1);
+	uintptr_t last = (uintptr_t(data) + bytes) & ~(page - 1);
+	if (last <= first) return true;
+	enum { MPOL_DEFAULT_ = 0, MPOL_PREFERRED_ = 1, MPOL_INTERLEAVE_ = 3 };
+	unsigned long mask[16] = { 0 };
+	int mode = MPOL_DEFAULT_;
+	if (placement == NUMA_INTERLEAVED) {
+		mode = MPOL_INTERLEAVE_;
+		for (int node = 0; node < std::min(numa_nodes(), 1024); node++) mask[node / 64] |= 1ul << (node % 64);
+	}
+	else if (placement == NUMA_SINGLE_NODE) {
+		mode = MPOL_PREFERRED_;					// unlike binding, spills over instead of failing when the node is full
+		mask[0] = 1;
+	}
+	return syscall(SYS_mbind, first, last - first, mode, mode == MPOL_DEFAULT_ ? nullptr : mask, mode == MPOL_DEFAULT_ ? 0ul : 1025ul, 0u) == 0;
+#else
+	(void)data;
+	(void)bytes;
+	return placement == NUMA_FIRST_TOUCH;		// first touch is what every OS does by default
+#endif
+}
+
+template<class F>
+inline void numa_for_slabs(size_t nSlabs, F f) {
+	const int nThreads = int(std::min(numa_cpus().size(), nSlabs));
+	if (nThreads <= 1 || numa_nodes() == 1) return f(size_t(0), nSlabs);
+	numa_affinity caller;								// the calling thread is block 0
+	auto block = [&](int t) {
+		numa_pin(numa_cpu(t, nThreads), t == 0 ? &caller : nullptr);
+		f(nSlabs * t / nThreads, nSlabs * (t + 1) / nThreads);
+	};
+	std::vector<std::thread> threads;
+	for (int t = 1; t < nThreads; t++) threads.push_back(std::thread(block, t));
+	block(0);
+	numa_unpin(caller);
+	for (auto& t : threads) t.join();
+}
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef __PAGE_ALLOCATOR_H__
+#define __PAGE_ALLOCATOR_H__
+
+#include<cstddef>
+#include<cstdint>
+#include<atomic>
+#include<memory>
+#include<new>
+#include<utility>
+
+#if defined(__linux__)
+#include<sys/mman.h>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include<windows.h>
+#endif
+
+// Allocator for the large arrays of the volume and of the extraction (voxels,
+// tags, edge maps). Two things differ from std::allocator:
+// - resize() leaves new elements of trivial types uninitialized instead of
+//   zeroing them from the calling thread, which would be the first touch of
+//   every page (see numa.h).
+// - Arrays of at least HUGE_PAGE bytes come directly from the OS, aligned to
+//   HUGE_PAGE, so they can be backed by 2 MB pages. Walking a volume along z
+//   touches a new 4 kB page every step; with 2 MB pages a few TLB entries
+//   cover whole slabs.
+// set_huge_pages() selects for all allocations from then on:
+//   HUGE_PAGES_OFF          4 kB pages (also opts out of transparent huge pages)
+//   HUGE_PAGES_TRANSPARENT  asks the kernel for transparent huge pages (madvise), the default
+//   HUGE_PAGES_EXPLICIT     reserved huge pages (MAP_HUGETLB, MEM_LARGE_PAGES); when
+//                           none are available, falls back to TRANSPARENT
+// Other systems get operator new for all of them.
+enum huge_page_mode { HUGE_PAGES_OFF, HUGE_PAGES_TRANSPARENT, HUGE_PAGES_EXPLICIT };
+static constexpr const size_t HUGE_PAGE = size_t(2) << 20;
+
+inline const char* huge_page_name(huge_page_mode mode);		// for printing
+inline void set_huge_pages(huge_page_mode mode);
+inline huge_page_mode huge_pages(void);
+inline size_t huge_page_fallbacks(void);					// EXPLICIT requests served with normal pages so far
+inline void* page_allocate(size_t bytes);					// bytes >= HUGE_PAGE, throws std::bad_alloc
+inline void page_free(void* data, size_t bytes);			// bytes as passed to page_allocate()
+
+template<class T>
+struct page_allocator : std::allocator<T> {
+	template<class U> struct rebind { using other = page_allocator<U>; };
+	page_allocator(void) = default;
+	template<class U> page_allocator(const page_allocator<U>&) {}
+	T* allocate(size_t n) {
+		if (n * sizeof(T) < HUGE_PAGE) return std::allocator<T>::allocate(n);
+		return static_cast<T*>(page_allocate(n * sizeof(T)));
+	}
+	void deallocate(T* p, size_t n) {
+		if (n * sizeof(T) < HUGE_PAGE) return std::allocator<T>::deallocate(p, n);
+		page_free(p, n * sizeof(T));
+	}
+	template<class U> void construct(U* p) { ::new(static_cast<void*>(p)) U; }
+	template<class U, class... Args> void construct(U* p, Args&&... args) { ::new(static_cast<void*>(p)) U(std::forward<Args>(args)...); }
+};
+
+inline std::atomic<int>& huge_page_setting(void) {
+	static std::atomic<int> mode(HUGE_PAGES_TRANSPARENT);
+	return mode;
+}
+
+inline std::atomic<size_t>& huge_page_fallback_count(void) {
+	static std::atomic<size_t> count(0);
+	return count;
+}
+
+inline const char* huge_page_name(huge_page_mode mode) {
+	switch (mode) {
+	case HUGE_PAGES_OFF: return "4 kB pages";
+	case HUGE_PAGES_EXPLICIT: return "explicit 2 MB";
+	default: return "transparent 2 MB";
+	}
+}
+
+inline void set_huge_pages(huge_page_mode mode) {
+	huge_page_setting().store(mode, std::memory_order_relaxed);
+}
+
+inline huge_page_mode huge_pages(void) {
+	return huge_page_mode(huge_page_setting().load(std::memory_order_relaxed));
+}
+
+inline size_t huge_page_fallbacks(void) {
+	return huge_page_fallback_count().load(std::memory_order_relaxed);
+}
+
+inline void* page_allocate(size_t bytes) {
+	const size_t size = (bytes + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+	const huge_page_mode mode = huge_pages();
+#if defined(__linux__)
+#ifdef MAP_HUGETLB
+	if (mode == HUGE_PAGES_EXPLICIT) {
+		void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) return p;
+	}
+#endif
+	if (mode == HUGE_PAGES_EXPLICIT) huge_page_fallback_count()++;
+	// map one huge page more and trim both ends to get a HUGE_PAGE aligned range
+	void* raw = mmap(nullptr, size + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED) throw std::bad_alloc();
+	char* begin = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(raw) + HUGE_PAGE - 1) & ~uintptr_t(HUGE_PAGE - 1));
+	char* end = static_cast<char*>(raw) + size + HUGE_PAGE;
+	if (begin > raw) munmap(raw, size_t(begin - static_cast<char*>(raw)));
+	if (end > begin + size) munmap(begin + size, size_t(end - (begin + size)));
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+	// a failing madvise() only means the kernel has no transparent huge pages
+	madvise(begin, size, mode == HUGE_PAGES_OFF ? MADV_NOHUGEPAGE : MADV_HUGEPAGE);
+#endif
+	return begin;
+#elif defined(_WIN32)
+	if (mode == HUGE_PAGES_EXPLICIT) {
+		// needs the "Lock pages in memory" privilege, without it the call fails
+		const size_t large = GetLargePageMinimum();
+		if (large > 0) {
+			void* p = VirtualAlloc(nullptr, (size + large - 1) / large * large, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			if (p) return p;
+		}
+		huge_page_fallback_count()++;
+	}
+	void* p = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (!p) throw std::bad_alloc();
+	return p;
+#else
+	if (mode == HUGE_PAGES_EXPLICIT) huge_page_fallback_count()++;
+	return ::operator new(size);
+#endif
+}
+
+inline void page_free(void* data, size_t bytes) {
+	if (!data) return;
+#if defined(__linux__)
+	munmap(data, (bytes + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+#elif defined(_WIN32)
+	(void)bytes;
+	VirtualFree(data, 0, MEM_RELEASE);
+#else
+	(void)bytes;
+	::operator delete(data);
+#endif
+}
+
+#endif
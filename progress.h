@@ -0,0 +1,166 @@
+#ifndef __PROGRESS_H__
+#define __PROGRESS_H__
+
+#include<atomic>
+#include<cassert>
+#include<algorithm>
+#include<array>
+#include<chrono>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<functional>
+
+// Progress reporting and cancellation for long running extractions.
+// Every worker thread counts its finished work items in a slot of its own
+// (one cache line each), so the hot loop only does an uncontended relaxed
+// store. Readers -- a monitor thread started by begin(), or any other thread
+// that polls fraction() -- sum up the slots. Without a monitor thread (see
+// watch()) the extractor calls poll() at slab boundaries instead, which runs
+// the callback on the polling thread once per period and starts no thread.
+// Cancellation is cooperative: cancel() raises a flag that the extractor
+// checks at slab boundaries. The flag is sticky until reset(), so a cancel
+// issued right before an extraction starts is not lost.
+class progress {
+public:
+	using callback = std::function<void(const progress&)>;
+	static constexpr const int MAX_WORKERS = 256;				// number of counter slots
+
+	inline progress(void);										// default constructor
+	inline progress(const callback& cb, double period = 1.0, bool monitor = true);	// cb every period seconds, see watch()
+	inline ~progress(void);										// destructor, stops the monitor
+	inline void watch(const callback& cb, double period = 1.0, bool monitor = true);	// set callback (before begin()), called by a
+																// monitor thread, or by poll() if !monitor
+	inline void begin(size_t total);							// start a new run of total work items
+	inline void end(void);										// finish run, stops the monitor
+	inline void advance(int worker, size_t n);					// worker finished n more items
+	inline void poll(void);										// calls the callback if a period has passed, without monitor
+	inline size_t done(void) const;								// items finished so far (all workers)
+	inline size_t total(void) const;							// items in this run
+	inline float fraction(void) const;							// done()/total() in [0,1]
+	inline double elapsed(void) const;							// seconds since begin()
+	inline void cancel(void);									// request cancellation (any thread)
+	inline bool cancelled(void) const;							// true iff cancel() was requested
+	inline void reset(void);									// clears counters and cancel flag
+protected:
+	struct alignas(64) slot {									// one cache line per worker, no false sharing
+		std::atomic<size_t> count;
+	};
+	inline void run_monitor(void);
+	std::array<slot, MAX_WORKERS> m_done;						// per worker counters
+	std::atomic<size_t> m_total;
+	std::atomic<bool> m_cancel;
+	std::chrono::steady_clock::time_point m_start;
+	callback m_callback;
+	double m_period;
+	bool m_monitored;											// the callback runs in m_monitor, not in poll()
+	std::atomic<double> m_next_poll;							// elapsed() of the next callback from poll()
+	std::thread m_monitor;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	bool m_running;
+private:
+	progress(const progress&);									// not copyable, workers hold pointers to it
+};
+
+inline progress::progress(void) : m_total(0), m_cancel(false), m_start(std::chrono::steady_clock::now()), m_period(1.0), m_monitored(true), m_next_poll(0.0), m_running(false) {
+	for (auto& s : m_done) s.count.store(0, std::memory_order_relaxed);
+}
+
+inline progress::progress(const callback& cb, double period, bool monitor) : progress() {
+	watch(cb, period, monitor);
+}
+
+inline progress::~progress(void) {
+	end();
+}
+
+inline void progress::watch(const callback& cb, double period, bool monitor) {
+	assert("progress::watch() -- cannot change callback of a running monitor" && !m_monitor.joinable());
+	m_callback = cb;
+	m_period = period;
+	m_monitored = monitor;
+}
+
+inline void progress::begin(size_t total) {
+	end();
+	for (auto& s : m_done) s.count.store(0, std::memory_order_relaxed);
+	m_total.store(total, std::memory_order_relaxed);
+	m_start = std::chrono::steady_clock::now();
+	m_next_poll.store(m_period, std::memory_order_relaxed);
+	if (m_callback && m_monitored) {
+		m_running = true;
+		m_monitor = std::thread(&progress::run_monitor, this);
+	}
+}
+
+inline void progress::end(void) {
+	if (!m_monitor.joinable()) return;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_running = false;
+	}
+	m_wake.notify_all();
+	m_monitor.join();
+}
+
+inline void progress::advance(int worker, size_t n) {
+	assert("progress::advance() -- invalid argument" && worker >= 0 && worker < MAX_WORKERS);
+	// only the owning worker writes its slot, so no read-modify-write is needed
+	std::atomic<size_t>& c = m_done[worker].count;
+	c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline void progress::poll(void) {
+	if (!m_callback || m_monitored) return;
+	// several workers may poll, the one that moves m_next_poll on reports
+	double next = m_next_poll.load(std::memory_order_relaxed);
+	const double now = elapsed();
+	if (now < next || !m_next_poll.compare_exchange_strong(next, now + m_period, std::memory_order_relaxed)) return;
+	m_callback(*this);
+}
+
+inline size_t progress::done(void) const {
+	size_t result = 0;
+	for (const auto& s : m_done) result += s.count.load(std::memory_order_relaxed);
+	return result;
+}
+
+inline size_t progress::total(void) const {
+	return m_total.load(std::memory_order_relaxed);
+}
+
+inline float progress::fraction(void) const {
+	size_t t = total();
+	if (t == 0) return 1.0f;
+	return std::min(float(double(done()) / double(t)), 1.0f);
+}
+
+inline double progress::elapsed(void) const {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+}
+
+inline void progress::cancel(void) {
+	m_cancel.store(true, std::memory_order_relaxed);
+}
+
+inline bool progress::cancelled(void) const {
+	return m_cancel.load(std::memory_order_relaxed);
+}
+
+inline void progress::reset(void) {
+	end();
+	for (auto& s : m_done) s.count.store(0, std::memory_order_relaxed);
+	m_total.store(0, std::memory_order_relaxed);
+	m_cancel.store(false, std::memory_order_relaxed);
+}
+
+inline void progress::run_monitor(void) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	auto period = std::chrono::duration<double>(m_period);
+	while (!m_wake.wait_for(lock, period, [this] { return !m_running; })) {
+		m_callback(*this);
+	}
+}
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+#include<inttypes.h>
+
+// Instruction set levels of the SIMD kernels, each one includes the ones before.
+// Kernels for all levels are compiled into the same binary (see SIMD_TARGET),
+// simd_detect() tells which of them the CPU and the OS support.
+enum simd_level { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_AVX512 };
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SIMD_X86
+#include<immintrin.h>
+#if defined(_MSC_VER)
+#include<intrin.h>
+#else
+#include<cpuid.h>
+#endif
+#endif
+
+// Compiles a single function for the given instruction set, independent of the
+// flags of its translation unit. MSVC allows all intrinsics everywhere.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define SIMD_TARGET(isa)
+#else
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+inline const char* simd_name(simd_level level);					// for printing
+inline simd_level simd_detect(void);							// highest supported level, determined once
+inline int simd_ctz(uint64_t mask);								// index of the lowest set bit, mask must not be 0
+inline int simd_popcount(uint64_t mask);						// number of set bits
+
+inline const char* simd_name(simd_level level) {
+	switch (level) {
+	case SIMD_SSE2: return "SSE2";
+	case SIMD_AVX2: return "AVX2";
+	case SIMD_AVX512: return "AVX-512";
+	default: return "scalar";
+	}
+}
+
+inline int simd_ctz(uint64_t mask) {
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long n;
+	_BitScanForward64(&n, mask);
+	return int(n);
+#elif defined(__GNUC__)
+	return __builtin_ctzll(mask);
+#else
+	int n = 0;
+	while (!(mask & 1u)) {
+		mask >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+inline int simd_popcount(uint64_t mask) {
+#if defined(_MSC_VER) && defined(_M_X64)
+	return int(__popcnt64(mask));
+#elif defined(__GNUC__)
+	return __builtin_popcountll(mask);
+#else
+	mask = mask - ((mask >> 1) & 0x5555555555555555ull);
+	mask = (mask & 0x3333333333333333ull) + ((mask >> 2) & 0x3333333333333333ull);
+	mask = (mask + (mask >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+	return int((mask * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+#ifdef SIMD_X86
+inline void simd_cpuid(unsigned leaf, unsigned subleaf, unsigned reg[4]) {
+#if defined(_MSC_VER)
+	int r[4];
+	__cpuidex(r, int(leaf), int(subleaf));
+	for (int i = 0; i < 4; i++) reg[i] = unsigned(r[i]);
+#else
+	reg[0] = reg[1] = reg[2] = reg[3] = 0;
+	if (__get_cpuid_max(0, nullptr) >= leaf) __cpuid_count(leaf, subleaf, reg[0], reg[1], reg[2], reg[3]);
+#endif
+}
+
+inline uint64_t simd_xgetbv(void) {
+	// which register states the OS saves on context switches
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	unsigned lo, hi;
+	__asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return (uint64_t(hi) << 32) | lo;
+#endif
+}
+#endif
+
+inline simd_level simd_detect(void) {
+	static const simd_level level = [] {
+		simd_level result = SIMD_SCALAR;
+#ifdef SIMD_X86
+		unsigned r1[4], r7[4];
+		simd_cpuid(1, 0, r1);
+		simd_cpuid(7, 0, r7);
+		if (r1[3] & (1u << 26)) result = SIMD_SSE2;
+		const bool osxsave = (r1[2] & (1u << 27)) != 0;
+		const uint64_t xcr0 = osxsave ? simd_xgetbv() : 0;
+		const bool ymm = (xcr0 & 0x06) == 0x06;					// SSE and AVX state
+		const bool zmm = (xcr0 & 0xE6) == 0xE6;					// and the AVX-512 opmask and upper registers
+		if (ymm && (r1[2] & (1u << 28)) && (r7[1] & (1u << 5))) result = SIMD_AVX2;
+		// the byte operations of the cell code kernel need AVX512BW on top of AVX512F
+		if (result == SIMD_AVX2 && zmm && (r7[1] & (1u << 16)) && (r7[1] & (1u << 30))) result = SIMD_AVX512;
+#endif
+		return result;
+	}();
+	return level;
+}
+
+#endif
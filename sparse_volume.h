@@ -0,0 +1,318 @@
+#ifndef __SPARSE_VOLUME_H__
+#define __SPARSE_VOLUME_H__
+
+#include<array>
+#include<vector>
+#include<cassert>
+#include<cmath>
+#include<algorithm>
+#include"ext_math.h"
+#include"volume_view.h"
+#include"implicit_field.h"
+#include"thread_pool.h"
+
+// A volume that only stores where it is not constant, for scans that are
+// mostly background. Like a VDB tree, with three levels:
+//   root   a table of internal nodes, one entry per NODE*LEAF voxels cubed,
+//          empty entries are background
+//   node   NODE^3 slots, each a leaf or a tile, a constant value for the
+//          LEAF^3 voxels it covers
+//   leaf   a brick of LEAF^3 voxels, x fastest
+// Every slot also keeps the smallest and largest value below it, so a box of
+// leaves can be skipped without reading it when an isovalue is outside all
+// their ranges (see MarchingCubes(const sparse_volume&)).
+// Memory is a root entry per 128^3 voxels of the bounding box, a node per
+// 128^3 box that holds anything but background and a leaf per brick of 8^3
+// that is not uniform. Leaves whose values differ by at most tolerance become
+// tiles of their midpoint (exact for tolerance 0); surfaces at isovalues
+// inside that band are lost in these bricks.
+// Voxels past the grid in the last leaf of an axis repeat the last voxel,
+// they are never part of the volume.
+class sparse_volume {
+public:
+	static constexpr const int LEAF = 8;						// voxels per leaf along each axis
+	static constexpr const int LEAF_SIZE = LEAF * LEAF * LEAF;
+	static constexpr const int NODE = 16;						// slots per node along each axis
+	static constexpr const int NODE_SIZE = NODE * NODE * NODE;
+	static constexpr const int NO_LEAF = -1;
+	struct slot {
+		int leaf;												// index of the leaf, NO_LEAF for a tile
+		float lo, hi;											// range of the values, lo is the value of a tile
+	};
+	inline sparse_volume(void);									// empty volume
+	inline sparse_volume(int dimx, int dimy, int dimz, float background = 0.0f);	// all background, nothing allocated
+	inline explicit sparse_volume(const volume_view& V, float background = 0.0f, float tolerance = 0.0f);
+	inline explicit sparse_volume(const implicit_field& F, float background = 0.0f, float tolerance = 0.0f, thread_pool* pool = nullptr);	// samples F a layer of leaves at a time
+	inline size_t dimension(size_t n) const;					// number of voxels along axis n
+	inline size_t size(void) const;								// total number of voxels
+	inline bool empty(void) const;
+	inline float background(void) const;
+	inline float operator()(int i, int j, int k) const;			// value of voxel ijk
+	inline float operator()(const vec3i& vox) const;
+	inline void set(int i, int j, int k, float value);			// allocates the node and leaf of ijk if needed
+	inline void prune(float tolerance = 0.0f);					// turns uniform leaves into tiles, drops nodes of background, recomputes the ranges
+	inline void fill(volume& V) const;							// resizes V to the dimensions and copies all voxels
+	inline void copy(const vec3i& lo, const vec3i& hi, float* out) const;	// voxels lo..hi-1 into out, x fastest
+	inline int leaf_dimension(size_t n) const;					// number of leaves along axis n
+	inline int node_dimension(size_t n) const;					// number of root entries along axis n
+	inline bool has_node(const vec3i& node) const;				// false if the root entry is background
+	inline slot find(const vec3i& leaf) const;					// slot of the leaf at leaf*LEAF, a background tile if there is no node
+	inline size_t nodes(void) const;							// allocated internal nodes
+	inline size_t leaves(void) const;							// allocated leaves
+	inline size_t memory(void) const;							// bytes held
+protected:
+	inline int root_index(const vec3i& node) const;				// position of node in m_root
+	inline slot* find_slot(const vec3i& leaf);					// nullptr if the node is not allocated
+	inline const slot* find_slot(const vec3i& leaf) const;
+	inline slot& make_slot(const vec3i& leaf);					// allocates the node if needed
+	inline void add_leaf_layer(const volume_view& layer, int lz, float tolerance);	// leaves of layer lz from the voxels of layer
+	inline static bool uniform(const float* v, float tolerance, float& lo, float& hi);	// range of a leaf, NaN if it has a NaN. RETURNS true if it fits a tile
+	std::array<int, 3> m_dims;
+	std::array<int, 3> m_leaf_dims;
+	std::array<int, 3> m_node_dims;
+	float m_background;
+	std::vector<int> m_root;									// node index per root entry, -1 for background
+	std::vector<slot> m_slots;									// NODE_SIZE per node
+	std::vector<float> m_leaves;								// LEAF_SIZE per leaf
+};
+
+inline sparse_volume::sparse_volume(void) : sparse_volume(0, 0, 0) {
+}
+
+inline sparse_volume::sparse_volume(int dimx, int dimy, int dimz, float background) : m_dims({ dimx,dimy,dimz }), m_background(background) {
+	assert("sparse_volume -- invalid argument(s)" && dimx >= 0 && dimy >= 0 && dimz >= 0);
+	if (dimx == 0 || dimy == 0 || dimz == 0) m_dims = { 0,0,0 };
+	for (int i = 0; i < 3; i++) {
+		m_leaf_dims[i] = (m_dims[i] + LEAF - 1) / LEAF;
+		m_node_dims[i] = (m_leaf_dims[i] + NODE - 1) / NODE;
+	}
+	m_root.assign(size_t(m_node_dims[0]) * size_t(m_node_dims[1]) * size_t(m_node_dims[2]), -1);
+}
+
+inline sparse_volume::sparse_volume(const volume_view& V, float background, float tolerance)
+	: sparse_volume(int(V.dimension(0)), int(V.dimension(1)), int(V.dimension(2)), background) {
+	for (int lz = 0; lz < m_leaf_dims[2]; lz++) {
+		add_leaf_layer(V.view(vec3i(0, 0, lz * LEAF), vec3i(m_dims[0], m_dims[1], (lz + 1) * LEAF)), lz, tolerance);
+	}
+}
+
+inline sparse_volume::sparse_volume(const implicit_field& F, float background, float tolerance, thread_pool* pool)
+	: sparse_volume(int(F.dimension(0)), int(F.dimension(1)), int(F.dimension(2)), background) {
+	// only one layer of leaves is evaluated at a time
+	const size_t slice = size_t(m_dims[0]) * size_t(m_dims[1]);
+	std::vector<float> layer(slice * LEAF);
+	for (int lz = 0; lz < m_leaf_dims[2]; lz++) {
+		const int z0 = lz * LEAF, z1 = std::min(z0 + LEAF, m_dims[2]);
+		F.evaluate(z0, z1, layer.data(), pool);
+		add_leaf_layer(volume_view(layer.data(), { m_dims[0], m_dims[1], z1 - z0 }, { 1, ptrdiff_t(m_dims[0]), ptrdiff_t(slice) }, vec3i(0, 0, z0)), lz, tolerance);
+	}
+}
+
+inline size_t sparse_volume::dimension(size_t n) const {
+	assert("sparse_volume::dimension() -- invalid argument" && n < 3);
+	return m_dims[n];
+}
+
+inline size_t sparse_volume::size(void) const {
+	return size_t(m_dims[0]) * size_t(m_dims[1]) * size_t(m_dims[2]);
+}
+
+inline bool sparse_volume::empty(void) const {
+	return size() == 0;
+}
+
+inline float sparse_volume::background(void) const {
+	return m_background;
+}
+
+inline float sparse_volume::operator()(int i, int j, int k) const {
+	assert("sparse_volume() -- invalid argument(s)" && i >= 0 && i < m_dims[0] && j >= 0 && j < m_dims[1] && k >= 0 && k < m_dims[2]);
+	const slot* s = find_slot(vec3i(i / LEAF, j / LEAF, k / LEAF));
+	if (s == nullptr) return m_background;
+	if (s->leaf == NO_LEAF) return s->lo;
+	return m_leaves[size_t(s->leaf) * LEAF_SIZE + size_t(i % LEAF + LEAF * (j % LEAF + LEAF * (k % LEAF)))];
+}
+
+inline float sparse_volume::operator()(const vec3i& vox) const {
+	return (*this)(vox.x, vox.y, vox.z);
+}
+
+inline void sparse_volume::set(int i, int j, int k, float value) {
+	assert("sparse_volume::set() -- invalid argument(s)" && i >= 0 && i < m_dims[0] && j >= 0 && j < m_dims[1] && k >= 0 && k < m_dims[2]);
+	const vec3i leaf(i / LEAF, j / LEAF, k / LEAF);
+	const slot* existing = find_slot(leaf);
+	if (existing == nullptr && value == m_background) return;
+	slot& s = make_slot(leaf);
+	if (s.leaf == NO_LEAF) {
+		if (value == s.lo) return;
+		// the tile becomes a leaf of its value
+		s.leaf = int(m_leaves.size() / LEAF_SIZE);
+		m_leaves.resize(m_leaves.size() + LEAF_SIZE, s.lo);
+	}
+	m_leaves[size_t(s.leaf) * LEAF_SIZE + size_t(i % LEAF + LEAF * (j % LEAF + LEAF * (k % LEAF)))] = value;
+	// the range only grows, prune() makes it exact again
+	s.lo = std::min(s.lo, value);
+	s.hi = std::max(s.hi, value);
+}
+
+inline void sparse_volume::prune(float tolerance) {
+	// 1. exact ranges, uniform leaves to tiles, the others compacted in order
+	std::vector<float> kept;
+	for (slot& s : m_slots) {
+		if (s.leaf == NO_LEAF) continue;
+		const float* v = m_leaves.data() + size_t(s.leaf) * LEAF_SIZE;
+		if (uniform(v, tolerance, s.lo, s.hi)) {
+			s.leaf = NO_LEAF;
+			continue;
+		}
+		s.leaf = int(kept.size() / LEAF_SIZE);
+		kept.insert(kept.end(), v, v + LEAF_SIZE);
+	}
+	m_leaves.swap(kept);
+
+	// 2. nodes with nothing but background tiles are dropped, the others compacted
+	std::vector<slot> slots;
+	for (int& n : m_root) {
+		if (n < 0) continue;
+		const slot* first = m_slots.data() + size_t(n) * NODE_SIZE;
+		const bool background = std::all_of(first, first + NODE_SIZE, [this](const slot& s) { return s.leaf == NO_LEAF && s.lo == m_background; });
+		if (background) {
+			n = -1;
+			continue;
+		}
+		n = int(slots.size() / NODE_SIZE);
+		slots.insert(slots.end(), first, first + NODE_SIZE);
+	}
+	m_slots.swap(slots);
+}
+
+inline void sparse_volume::fill(volume& V) const {
+	V.resize(m_dims[0], m_dims[1], m_dims[2]);
+	if (V.empty()) return;
+	copy(vec3i(0, 0, 0), vec3i(m_dims[0], m_dims[1], m_dims[2]), &V[0]);
+}
+
+inline void sparse_volume::copy(const vec3i& lo, const vec3i& hi, float* out) const {
+	assert("sparse_volume::copy() -- invalid argument(s)" && lo.x >= 0 && lo.y >= 0 && lo.z >= 0
+		&& hi.x <= m_dims[0] && hi.y <= m_dims[1] && hi.z <= m_dims[2] && lo.x <= hi.x && lo.y <= hi.y && lo.z <= hi.z);
+	// row by row, a run of voxels per leaf the row passes
+	for (int k = lo.z; k < hi.z; k++) {
+		for (int j = lo.y; j < hi.y; j++) {
+			for (int i = lo.x; i < hi.x;) {
+				const vec3i leaf(i / LEAF, j / LEAF, k / LEAF);
+				const int end = std::min(hi.x, (leaf.x + 1) * LEAF);
+				const slot* s = find_slot(leaf);
+				if (s == nullptr) out = std::fill_n(out, end - i, m_background);
+				else if (s->leaf == NO_LEAF) out = std::fill_n(out, end - i, s->lo);
+				else {
+					const float* v = m_leaves.data() + size_t(s->leaf) * LEAF_SIZE + size_t(LEAF * (j % LEAF + LEAF * (k % LEAF)));
+					out = std::copy(v + i % LEAF, v + i % LEAF + (end - i), out);
+				}
+				i = end;
+			}
+		}
+	}
+}
+
+inline int sparse_volume::leaf_dimension(size_t n) const {
+	assert("sparse_volume::leaf_dimension() -- invalid argument" && n < 3);
+	return m_leaf_dims[n];
+}
+
+inline int sparse_volume::node_dimension(size_t n) const {
+	assert("sparse_volume::node_dimension() -- invalid argument" && n < 3);
+	return m_node_dims[n];
+}
+
+inline bool sparse_volume::has_node(const vec3i& node) const {
+	return m_root[root_index(node)] >= 0;
+}
+
+inline sparse_volume::slot sparse_volume::find(const vec3i& leaf) const {
+	const slot* s = find_slot(leaf);
+	return s ? *s : slot{ NO_LEAF, m_background, m_background };
+}
+
+inline size_t sparse_volume::nodes(void) const {
+	return m_slots.size() / NODE_SIZE;
+}
+
+inline size_t sparse_volume::leaves(void) const {
+	return m_leaves.size() / LEAF_SIZE;
+}
+
+inline size_t sparse_volume::memory(void) const {
+	return m_root.capacity() * sizeof(int) + m_slots.capacity() * sizeof(slot) + m_leaves.capacity() * sizeof(float);
+}
+
+inline int sparse_volume::root_index(const vec3i& node) const {
+	assert("sparse_volume::root_index() -- invalid argument(s)" && node.x >= 0 && node.x < m_node_dims[0]
+		&& node.y >= 0 && node.y < m_node_dims[1] && node.z >= 0 && node.z < m_node_dims[2]);
+	return node.x + m_node_dims[0] * (node.y + m_node_dims[1] * node.z);
+}
+
+inline sparse_volume::slot* sparse_volume::find_slot(const vec3i& leaf) {
+	return const_cast<slot*>(static_cast<const sparse_volume*>(this)->find_slot(leaf));
+}
+
+inline const sparse_volume::slot* sparse_volume::find_slot(const vec3i& leaf) const {
+	const int n = m_root[root_index(vec3i(leaf.x / NODE, leaf.y / NODE, leaf.z / NODE))];
+	if (n < 0) return nullptr;
+	return &m_slots[size_t(n) * NODE_SIZE + size_t(leaf.x % NODE + NODE * (leaf.y % NODE + NODE * (leaf.z % NODE)))];
+}
+
+inline sparse_volume::slot& sparse_volume::make_slot(const vec3i& leaf) {
+	int& n = m_root[root_index(vec3i(leaf.x / NODE, leaf.y / NODE, leaf.z / NODE))];
+	if (n < 0) {
+		n = int(m_slots.size() / NODE_SIZE);
+		m_slots.resize(m_slots.size() + NODE_SIZE, slot{ NO_LEAF, m_background, m_background });
+	}
+	return *find_slot(leaf);
+}
+
+inline void sparse_volume::add_leaf_layer(const volume_view& layer, int lz, float tolerance) {
+	const int dimz = int(layer.dimension(2));
+	float v[LEAF_SIZE];
+	for (int ly = 0; ly < m_leaf_dims[1]; ly++) {
+		for (int lx = 0; lx < m_leaf_dims[0]; lx++) {
+			// the voxels of the leaf, those past the grid repeat the last one
+			for (int k = 0; k < LEAF; k++) {
+				const int z = std::min(k, dimz - 1);
+				for (int j = 0; j < LEAF; j++) {
+					const int y = std::min(ly * LEAF + j, m_dims[1] - 1);
+					for (int i = 0; i < LEAF; i++) v[i + LEAF * (j + LEAF * k)] = layer(std::min(lx * LEAF + i, m_dims[0] - 1), y, z);
+				}
+			}
+			float lo, hi;
+			const vec3i leaf(lx, ly, lz);
+			if (uniform(v, tolerance, lo, hi)) {
+				if (find_slot(leaf) == nullptr && lo == m_background) continue;
+				make_slot(leaf) = slot{ NO_LEAF, lo, hi };
+				continue;
+			}
+			slot& s = make_slot(leaf);
+			s = slot{ int(m_leaves.size() / LEAF_SIZE), lo, hi };
+			m_leaves.insert(m_leaves.end(), v, v + LEAF_SIZE);
+		}
+	}
+}
+
+inline bool sparse_volume::uniform(const float* v, float tolerance, float& lo, float& hi) {
+	lo = hi = v[0];
+	bool nan = false;
+	for (int n = 0; n < LEAF_SIZE; n++) {
+		lo = std::min(lo, v[n]);
+		hi = std::max(hi, v[n]);
+		nan |= std::isnan(v[n]);
+	}
+	if (nan) {
+		// no range, every isovalue may cut the leaf
+		lo = hi = std::nanf("");
+		return false;
+	}
+	if (hi - lo > tolerance) return false;
+	lo = hi = 0.5f * (lo + hi);
+	return true;
+}
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef __SYNTHETIC_FIELDS_H__
+#define __SYNTHETIC_FIELDS_H__
+
+#include<cmath>
+#include<algorithm>
+#include<vector>
+#include<string>
+#include<inttypes.h>
+#include"implicit_field.h"
+
+// Deterministic test fields on an n x n x n grid that range from a few percent
+// of the cells cut by the surface (active cells) to all of them:
+//   sphere        one smooth surface, a few percent of the cells for n = 128
+//   gyroid        a triply periodic minimal surface, periods per axis
+//   noise         value noise summed over octaves, each twice as fine, the
+//                 finest near the voxel size: many small, irregular pieces
+//   checkerboard  alternating blocks of 0 and 1, with block = 1 every cell
+//                 is active and has the most triangles a case produces
+// ball_field() is not part of the suite: a solid of constant value in a
+// constant background, like an object in a scan, see sparse_volume.
+// Each is an implicit_field: MarchingCubes extracts it directly or fill()
+// samples it into a volume. Values lie in [0,1] (the corners of the sphere
+// field go a little below), the surfaces are at isovalue 0.5.
+inline implicit_field sphere_field(int n, float radius = 0.8f);			// radius relative to half the grid
+inline implicit_field gyroid_field(int n, float periods = 4.0f);
+inline implicit_field noise_field(int n, int octaves = 5, uint32_t seed = 1);
+inline implicit_field checkerboard_field(int n, int block = 1);
+inline implicit_field ball_field(int n, const vec3f& center, float radius, float ramp = 2.0f);	// 1 inside, 0 outside, ramp voxels between
+
+struct synthetic_dataset {
+	std::string name;
+	implicit_field field;
+	float isovalue;
+};
+inline std::vector<synthetic_dataset> synthetic_suite(int n);				// the fields above, roughly from the fewest active cells to the most
+
+inline implicit_field sphere_field(int n, float radius) {
+	// distance from the center in units of half the grid, 0.5 on the sphere
+	const float c = 0.5f * float(n - 1), scale = 1.0f / (c > 0.0f ? c : 1.0f);
+	const float k = 0.5f / radius;
+	return implicit_field(n, n, n, [c, scale, k](float x, float y, float z) {
+		x = (x - c) * scale;
+		y = (y - c) * scale;
+		z = (z - c) * scale;
+		return 1.0f - k * std::sqrt(x * x + y * y + z * z);
+	});
+}
+
+inline implicit_field gyroid_field(int n, float periods) {
+	// sin x cos y + sin y cos z + sin z cos x lies in [-1.5,1.5]
+	const float w = 2.0f * 3.14159265f * periods / float(n > 1 ? n - 1 : 1);
+	return implicit_field(n, n, n, [w](float x, float y, float z) {
+		x *= w;
+		y *= w;
+		z *= w;
+		float g = std::sin(x) * std::cos(y) + std::sin(y) * std::cos(z) + std::sin(z) * std::cos(x);
+		return 0.5f + g / 3.0f;
+	});
+}
+
+// lattice value in [0,1) from a hash of its integer coordinates
+inline float synthetic_lattice(int x, int y, int z, uint32_t seed) {
+	uint32_t h = seed ^ (uint32_t(x) * 0x8da6b343u) ^ (uint32_t(y) * 0xd8163841u) ^ (uint32_t(z) * 0xcb1ab31fu);
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return float(h >> 8) * (1.0f / 16777216.0f);
+}
+
+// trilinear interpolation of the lattice values with smoothstep weights
+inline float synthetic_value_noise(float x, float y, float z, uint32_t seed) {
+	const float fx = std::floor(x), fy = std::floor(y), fz = std::floor(z);
+	const int ix = int(fx), iy = int(fy), iz = int(fz);
+	float tx = x - fx, ty = y - fy, tz = z - fz;
+	tx = tx * tx * (3.0f - 2.0f * tx);
+	ty = ty * ty * (3.0f - 2.0f * ty);
+	tz = tz * tz * (3.0f - 2.0f * tz);
+	float v[2][2];
+	for (int k = 0; k < 2; k++) {
+		for (int j = 0; j < 2; j++) {
+			float a = synthetic_lattice(ix, iy + j, iz + k, seed);
+			float b = synthetic_lattice(ix + 1, iy + j, iz + k, seed);
+			v[k][j] = a + tx * (b - a);
+		}
+	}
+	float lo = v[0][0] + ty * (v[0][1] - v[0][0]);
+	float hi = v[1][0] + ty * (v[1][1] - v[1][0]);
+	return lo + tz * (hi - lo);
+}
+
+inline implicit_field noise_field(int n, int octaves, uint32_t seed) {
+	// the finest octave has a feature every 2 voxels, each coarser one twice
+	// the size and twice the amplitude; normalized by the sum of amplitudes
+	if (octaves < 1) octaves = 1;
+	const float finest = 0.5f;
+	return implicit_field(n, n, n, [octaves, seed, finest](float x, float y, float z) {
+		float sum = 0.0f, norm = 0.0f, amplitude = 1.0f;
+		float frequency = finest / float(1 << (octaves - 1));
+		for (int o = 0; o < octaves; o++) {
+			sum += amplitude * synthetic_value_noise(x * frequency, y * frequency, z * frequency, seed + uint32_t(o));
+			norm += amplitude;
+			amplitude *= 0.5f;
+			frequency *= 2.0f;
+		}
+		return sum / norm;
+	});
+}
+
+inline implicit_field checkerboard_field(int n, int block) {
+	if (block < 1) block = 1;
+	const int b = block;
+	return implicit_field(n, n, n, [b](float x, float y, float z) {
+		return float(((int(x) / b) + (int(y) / b) + (int(z) / b)) & 1);
+	});
+}
+
+inline implicit_field ball_field(int n, const vec3f& center, float radius, float ramp) {
+	const vec3f c = center;
+	const float r = radius, w = 1.0f / ramp;
+	return implicit_field(n, n, n, [c, r, w](float x, float y, float z) {
+		x -= c.x;
+		y -= c.y;
+		z -= c.z;
+		float v = 0.5f + (r - std::sqrt(x * x + y * y + z * z)) * w;
+		return std::min(std::max(v, 0.0f), 1.0f);
+	});
+}
+
+inline std::vector<synthetic_dataset> synthetic_suite(int n) {
+	std::vector<synthetic_dataset> suite;
+	suite.push_back({ "sphere", sphere_field(n), 0.5f });
+	suite.push_back({ "gyroid, 4 periods", gyroid_field(n, 4.0f), 0.5f });
+	suite.push_back({ "noise, 5 octaves", noise_field(n, 5), 0.5f });
+	suite.push_back({ "gyroid, n/8 periods", gyroid_field(n, float(n) / 8.0f), 0.5f });
+	suite.push_back({ "checkerboard, blocks of 4", checkerboard_field(n, 4), 0.5f });
+	suite.push_back({ "checkerboard, blocks of 1", checkerboard_field(n, 1), 0.5f });
+	return suite;
+}
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include<cassert>
+#include<algorithm>
+#include<chrono>
+#include<memory>
+#include<vector>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include"numa.h"
+
+// A fixed set of worker threads that stay alive between calls to run(), so
+// repeated extractions do not pay for thread creation.
+// run(n, f) executes the tasks f(0..n-1, worker) and returns when all are done.
+// The tasks are dealt out to per worker queues in contiguous blocks, so tasks
+// with neighboring numbers (neighboring bricks) tend to run on the same worker.
+// A worker takes tasks from the front of its own queue; once that is empty it
+// steals from the back of the others', so uneven tasks balance automatically.
+// A queue is just the range of task numbers left, and f is called through a
+// plain function pointer, so run() does not allocate.
+// The thread calling run() works as worker 0.
+// A pinned pool keeps worker w on cpu numa_cpu(w, size()), the cpu that
+// numa_for_slabs() uses for the w-th block of slabs, so with one task per
+// slab or per brick (in z order) a worker mostly reads memory of its node.
+class thread_pool {
+public:
+	static constexpr const int MAX_THREADS = 64;
+
+	inline explicit thread_pool(int nThreads = 0, bool pinned = false);	// 0: one thread per hardware thread
+	inline ~thread_pool(void);									// destructor, joins the workers
+	inline int size(void) const;								// number of workers, including the caller of run()
+	inline bool pinned(void) const;								// workers bound to cpus
+	template<class F>
+	inline void run(size_t nTasks, const F& f);					// runs f(task, worker) for all tasks, blocks until they are done
+
+	// statistics, summed over all run() calls since the last reset_statistics()
+	inline void reset_statistics(void);
+	inline double wall(void) const;								// seconds from start to end of run()
+	inline double busy(int worker) const;						// seconds worker spent in tasks
+	inline size_t executed(int worker) const;					// tasks run by worker
+	inline size_t stolen(int worker) const;						// of these, tasks taken from other queues
+protected:
+	struct alignas(64) queue {									// one cache line per worker, no false sharing
+		std::mutex mutex;
+		size_t front, back;										// tasks [front,back) are left
+		double busy;
+		size_t executed, stolen;
+	};
+	using call = void (*)(const void* f, size_t task, int worker);
+	inline void run_tasks(size_t nTasks, const void* f, call c);	// type erased run()
+	inline bool pop(int worker, size_t& task);					// own queue first, then steal
+	inline void work(int worker);								// runs tasks until all queues are empty
+	inline void run_worker(int worker);							// main loop of the threads
+	std::unique_ptr<queue[]> m_queue;
+	std::vector<std::thread> m_threads;
+	int m_size;
+	const void* m_task;
+	call m_call;
+	std::mutex m_mutex;
+	std::condition_variable m_wake, m_finished;
+	size_t m_generation;										// counts run() calls, wakes the workers
+	int m_running;												// workers still busy with this run()
+	bool m_stop;
+	bool m_pinned;
+	double m_wall;
+private:
+	thread_pool(const thread_pool&);							// not copyable, the threads point to it
+};
+
+inline thread_pool::thread_pool(int nThreads, bool pinned) : m_size(nThreads), m_task(nullptr), m_call(nullptr), m_generation(0), m_running(0), m_stop(false), m_pinned(pinned), m_wall(0.0) {
+	if (m_size <= 0) m_size = int(std::thread::hardware_concurrency());
+	m_size = std::min(std::max(m_size, 1), int(MAX_THREADS));
+	m_queue.reset(new queue[m_size]);
+	for (int w = 0; w < m_size; w++) m_queue[w].front = m_queue[w].back = 0;
+	reset_statistics();
+	for (int w = 1; w < m_size; w++) m_threads.push_back(std::thread(&thread_pool::run_worker, this, w));
+}
+
+inline thread_pool::~thread_pool(void) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (auto& t : m_threads) t.join();
+}
+
+inline int thread_pool::size(void) const {
+	return m_size;
+}
+
+inline bool thread_pool::pinned(void) const {
+	return m_pinned;
+}
+
+template<class F>
+inline void thread_pool::run(size_t nTasks, const F& f) {
+	run_tasks(nTasks, &f, [](const void* f, size_t task, int worker) { (*static_cast<const F*>(f))(task, worker); });
+}
+
+inline void thread_pool::run_tasks(size_t nTasks, const void* f, call c) {
+	auto start = std::chrono::steady_clock::now();
+	for (int w = 0; w < m_size; w++) {
+		// worker w gets the w-th contiguous block of tasks
+		m_queue[w].front = nTasks * w / m_size;
+		m_queue[w].back = nTasks * (w + 1) / m_size;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_task = f;
+		m_call = c;
+		m_running = m_size - 1;
+		m_generation++;
+	}
+	m_wake.notify_all();
+	// the caller is only pinned while it works for the pool, then gets its own affinity back
+	numa_affinity caller;
+	if (m_pinned) numa_pin(numa_cpu(0, m_size), &caller);
+	work(0);
+	if (m_pinned) numa_unpin(caller);
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_finished.wait(lock, [this] { return m_running == 0; });
+	m_task = nullptr;
+	m_call = nullptr;
+	m_wall += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline void thread_pool::reset_statistics(void) {
+	for (int w = 0; w < m_size; w++) {
+		m_queue[w].busy = 0.0;
+		m_queue[w].executed = m_queue[w].stolen = 0;
+	}
+	m_wall = 0.0;
+}
+
+inline double thread_pool::wall(void) const {
+	return m_wall;
+}
+
+inline double thread_pool::busy(int worker) const {
+	assert("thread_pool::busy() -- invalid argument" && worker >= 0 && worker < m_size);
+	return m_queue[worker].busy;
+}
+
+inline size_t thread_pool::executed(int worker) const {
+	assert("thread_pool::executed() -- invalid argument" && worker >= 0 && worker < m_size);
+	return m_queue[worker].executed;
+}
+
+inline size_t thread_pool::stolen(int worker) const {
+	assert("thread_pool::stolen() -- invalid argument" && worker >= 0 && worker < m_size);
+	return m_queue[worker].stolen;
+}
+
+inline bool thread_pool::pop(int worker, size_t& task) {
+	{
+		queue& Q = m_queue[worker];
+		std::lock_guard<std::mutex> lock(Q.mutex);
+		if (Q.front < Q.back) {
+			task = Q.front++;
+			return true;
+		}
+	}
+	// Tasks are only added by run(), so once a full round finds all queues
+	// empty, there is nothing left to do for this run.
+	for (int n = 1; n < m_size; n++) {
+		queue& V = m_queue[(worker + n) % m_size];
+		std::lock_guard<std::mutex> lock(V.mutex);
+		if (V.front < V.back) {
+			task = --V.back;
+			m_queue[worker].stolen++;
+			return true;
+		}
+	}
+	return false;
+}
+
+inline void thread_pool::work(int worker) {
+	queue& Q = m_queue[worker];
+	size_t task;
+	while (pop(worker, task)) {
+		auto start = std::chrono::steady_clock::now();
+		m_call(m_task, task, worker);
+		Q.busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		Q.executed++;
+	}
+}
+
+inline void thread_pool::run_worker(int worker) {
+	size_t generation = 0;
+	if (m_pinned) numa_pin(numa_cpu(worker, m_size));
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true) {
+		m_wake.wait(lock, [&] { return m_stop || m_generation != generation; });
+		if (m_stop) return;
+		generation = m_generation;
+		lock.unlock();
+		work(worker);
+		lock.lock();
+		if (--m_running == 0) m_finished.notify_one();
+	}
+}
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef __VALUE_INDEX_H__
+#define __VALUE_INDEX_H__
+
+#include<vector>
+#include<cassert>
+#include<cmath>
+#include<inttypes.h>
+#include<algorithm>
+
+// Voxel addresses ordered by value, built with a counting sort on the value
+// quantized into nBuckets equal ranges between the smallest and largest value.
+// It answers "which voxels lie in (lo,hi]" in time proportional to the number
+// of voxels in the buckets overlapping that range, which is what an isovalue
+// change needs: exactly the voxels between the old and new isovalue change sides.
+// The index does not hold on to the data, the same data has to be passed to
+// for_each_between() (see volume::build_index()). Addresses are stored in
+// 32 bits, so at most MAX_SIZE voxels can be indexed.
+class value_index {
+public:
+	static constexpr const size_t MAX_SIZE = size_t(UINT32_MAX) + 1;
+	inline value_index(const float* data, size_t n, int nBuckets = 4096);
+	template<class F>
+	inline void for_each_between(const float* data, float lo, float hi, F f) const;	// f(n) for all n with lo < data[n] <= hi
+	inline size_t count_between(float lo, float hi) const;		// upper bound of the voxels visited by for_each_between()
+	inline size_t memory(void) const;							// bytes held
+protected:
+	inline int bucket(float value) const;
+	std::vector<uint32_t> m_order;								// voxel addresses, sorted by bucket
+	std::vector<size_t> m_first;								// m_order[m_first[b]..m_first[b+1]) is bucket b
+	float m_min, m_scale;
+};
+
+inline value_index::value_index(const float* data, size_t n, int nBuckets) : m_min(0.0f), m_scale(0.0f) {
+	assert("value_index -- invalid argument(s)" && nBuckets > 0 && n <= MAX_SIZE);
+	if (n == 0) nBuckets = 1;
+	float vmax = 0.0f;
+	if (n > 0) {
+		auto range = std::minmax_element(data, data + n);
+		m_min = *range.first;
+		vmax = *range.second;
+	}
+	m_scale = vmax > m_min ? float(nBuckets) / (vmax - m_min) : 0.0f;
+
+	// counting sort: histogram, exclusive prefix sum, scatter
+	m_first.assign(size_t(nBuckets) + 1, 0);
+	for (size_t i = 0; i < n; i++) m_first[size_t(bucket(data[i])) + 1]++;
+	for (int b = 0; b < nBuckets; b++) m_first[b + 1] += m_first[b];
+	std::vector<size_t> next(m_first.begin(), m_first.end() - 1);
+	m_order.resize(n);
+	for (size_t i = 0; i < n; i++) m_order[next[bucket(data[i])]++] = uint32_t(i);
+}
+
+inline int value_index::bucket(float value) const {
+	int nBuckets = int(m_first.size()) - 1;
+	float b = (value - m_min) * m_scale;
+	if (!(b > 0.0f)) return 0;		// also catches NaN
+	return std::min(int(b), nBuckets - 1);
+}
+
+template<class F>
+inline void value_index::for_each_between(const float* data, float lo, float hi, F f) const {
+	if (!(lo < hi)) return;
+	int bmax = bucket(hi);
+	for (size_t k = m_first[bucket(lo)]; k < m_first[size_t(bmax) + 1]; k++) {
+		uint32_t n = m_order[k];
+		if (data[n] > lo && data[n] <= hi) f(size_t(n));
+	}
+}
+
+inline size_t value_index::count_between(float lo, float hi) const {
+	if (!(lo < hi)) return 0;
+	return m_first[size_t(bucket(hi)) + 1] - m_first[bucket(lo)];
+}
+
+inline size_t value_index::memory(void) const {
+	return m_order.capacity() * sizeof(uint32_t) + m_first.capacity() * sizeof(size_t);
+}
+
+#endif
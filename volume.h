@@ -2,10 +2,17 @@
 #define __VOLUME_H__
 
 #include<vector>
+#include<utility>
 #include<array>
 #include<cassert>
 #include<fstream>
+#include<memory>
 #include"ext_math.h"
+#include"value_index.h"
+#include"contour_spectrum.h"
+#include"volume_view.h"
+#include"numa.h"
+#include"page_allocator.h"
 
 // Here, I provide a shallow wrapper for volumes
 // Since everything is declared as inline, there is only a header file,
@@ -13,15 +20,20 @@
 class volume {
 public:
 	inline volume(void);										// default constructor
-	inline volume(const volume& other);							// copy constructor
+	inline explicit volume(const volume& other);				// copy constructor, deep copies have to be asked for
+	inline volume(volume&& other) noexcept;						// move constructor, takes over the voxels of other
 	inline volume(int dimx, int dimy, int dimz);				// initialized constructor
+	inline explicit volume(const volume_view& V);				// deep copy of the voxels of a view
 	inline ~volume(void);										// destructor
-	inline volume& operator=(const volume& other);				// assignment operator
+	inline volume& operator=(volume&& other) noexcept;			// move assignment, other is left empty
+	inline volume& copy_from(const volume& other);				// deep copy, shares index() and spectrum()
 	inline size_t dimension(size_t n) const;					// number of voxels along axis n
 	inline size_t size(void) const;								// total number of voxels
 	inline bool empty(void) const;								// true if volume empty (size = 0x0x0)
 	inline void clear(void);									// empties the volume
-	inline void resize(int dimx, int dimy, int dimz);			// resizes volume to desired resolutions
+	inline void resize(int dimx, int dimy, int dimz);			// resizes volume to desired resolutions, zeroed by slab in parallel
+	inline void place(numa_placement placement);				// moves the voxels to pages placed as requested, also for later resizes
+	inline numa_placement placement(void) const;
 	inline float& operator()(int i, int j, int k);				// read/write access to voxel at ijk
 	inline const float& operator()(int i, int j, int k) const;	// read-only access to voxel at ijk
 	inline float& operator[](size_t n);							// read/write access to voxel at memory location n
@@ -30,11 +42,26 @@ public:
 	inline const float& operator[](size_t n) const;				// read-only access to voxel at memory location n
 	inline size_t linear_address(int i, int j, int k) const;	// computes the memory location of voxel ijk
 	inline bool import_dat(const std::string& name);			// volume importer
+	inline bool export_dat(const std::string& name) const;		// volume exporter, see volume_view::export_dat()
+	inline volume_view view(void) const;						// all voxels, with index() and spectrum()
+	inline volume_view view(const vec3i& lo, const vec3i& hi, int step = 1) const;	// voxels lo..hi-1, every step-th along each axis, no copy
 	inline volume subsampled(void) const;						// TASK 3b
 	inline volume& subsample(void);								// TASK 3b
+	inline void build_index(int nBuckets = 4096);				// builds index(), has to be called again after writing voxels,
+																// none beyond value_index::MAX_SIZE voxels, index() is nullptr then
+	inline const value_index* index(void) const;				// voxels sorted by value, nullptr if not built
+	template<class F>
+	inline bool for_each_between(float lo, float hi, F f) const;	// f(n) for voxels with lo < value <= hi. RETURNS false without index
+	inline void build_spectrum(int nSamples = 256, thread_pool* pool = nullptr);	// builds spectrum(), has to be called again after writing voxels
+	inline const contour_spectrum* spectrum(void) const;		// surface size over all isovalues, nullptr if not built
 protected:
-	std::vector<float>  m_data;									// stores actual data
+	std::vector<float, page_allocator<float>> m_data;		// stores actual data, first touched by resize()
 	std::array<int, 3>	m_dims;									// stores dimensions
+	numa_placement m_placement;
+	std::shared_ptr<const value_index> m_index;					// optional, shared by copies (same values)
+	std::shared_ptr<const contour_spectrum> m_spectrum;			// optional, shared by copies
+private:
+	volume& operator=(const volume& other) = delete;			// no implicit deep copies, see copy_from()
 };
 
 /*
@@ -45,73 +72,27 @@ version of the object, while maintaining the integrity of the original argument.
 In the case of subsample, the object is taken as an argument, and modification will be 
 done on the object itself rather than a copy. Effectively altering the object. This will not return anything.
 */
-inline volume volume::subsampled(void) const{
-	// TASK 3b: implement subsampling to half the volume's resolution
-	//          along each dimension. To do so, first create a new
-	//          result volume of resolution (m_dims[0]+1)/2,
-	//		    (m_dims[1]+1)/2, (m_dims[2]+1)/2 (rounding up).
-	//		    Then, for each voxel in new volume, average
-	//          over the corresponding voxels in "Vol". 
-	//          Most voxels will be the average of a 2x2x2 region,
-	//          but you need to pay attention at the boundary if
-	//		    one of the m_dims is odd...
-	const volume& Vol(*this); // short-hand variable "Vol" is this object.
-
-	// 1. create result volume of correct size
-	volume result((m_dims[0] + 1) / 2, (m_dims[1] + 1) / 2, (m_dims[2] + 1) / 2);
-
-	// 2. iterate all voxels in input volume
-	// HINT: See below code, which in Python translates to
-	//       "kmax = 2*k+1 if 2*k+1<Vol.dimension(2) else 2*k
-	for (int k = 0; k < result.dimension(2); k++) {
-		int kmax = 2 * k + 1 < Vol.dimension(2) ? 2 * k + 1 : 2 * k;
-		for (int j = 0; j < result.dimension(1); j++) {
-			int jmax = 2 * j + 1 < Vol.dimension(1) ? 2 * j + 1 : 2 * j;
-			for (int i = 0; i < result.dimension(0); i++) {
-				int imax = 2 * i + 1 < Vol.dimension(0) ? 2 * i + 1 : 2 * i;
-				for (int z = 2 * k; z < kmax + 1; z++) {
-					for (int y = 2 * j; y < jmax + 1; y++) {
-						for (int x = 2 * i; x < imax + 1; x++) {
-							result(i, j, k) += Vol(x, y, z);
-
-						}
-					}
-				}
-				result(i, j, k) /= (float(imax + 1 - 2 * i)) * (float(jmax + 1 - 2 * j)) * (float(kmax + 1 - 2 * k));
-			}
-		}
-	// Now proceed analogously for j,i
-		
-	
-	
-				// Finally, you need three more loops to collect relevant voxels from Vol
-				// These loops run from 2*{i,j,k} to (including!) {imax,jmax,kmax}. 
-				// Make sure to divide the average by the correct number of voxels
-				
-
-
-
-				// Now, divide by float(nVoxels)
-		
-
-	}
-	// Finally, return the result
-	return result;
+inline volume volume::subsampled(void) const {
+	return view().subsampled();
 }
 
 inline volume& volume::subsample(void) {
-	*this = this->subsampled();
+	*this = this->subsampled();	// moves, the subsampled temporary is not copied
 	return *this;
 }
 
-inline volume::volume(void) : m_dims({ 0,0,0 }) {
+inline volume::volume(void) : m_dims({ 0,0,0 }), m_placement(NUMA_FIRST_TOUCH) {
+}
+
+inline volume::volume(const volume& other) : m_dims({ 0,0,0 }), m_placement(NUMA_FIRST_TOUCH) {
+	copy_from(other);
 }
 
-inline volume::volume(const volume& other) : m_dims({ 0,0,0 }) {
-	*this = other;
+inline volume::volume(volume&& other) noexcept : m_dims({ 0,0,0 }), m_placement(NUMA_FIRST_TOUCH) {
+	*this = std::move(other);
 }
 
-inline volume::volume(int dimx, int dimy, int dimz) : m_dims({ 0,0,0 }) {
+inline volume::volume(int dimx, int dimy, int dimz) : m_dims({ 0,0,0 }), m_placement(NUMA_FIRST_TOUCH) {
 	resize(dimx, dimy, dimz);
 }
 
@@ -119,9 +100,31 @@ inline volume::~volume(void) {
 	clear();
 }
 
-inline volume& volume::operator=(const volume& other) {
-	m_data = other.m_data;
+inline volume& volume::copy_from(const volume& other) {
+	if (this == &other) return *this;
+	if (other.empty()) {
+		clear();
+		return *this;
+	}
+	// copy slab by slab on the threads that first touched them
+	resize(other.m_dims[0], other.m_dims[1], other.m_dims[2]);
+	const size_t slab = size_t(m_dims[0]) * size_t(m_dims[1]);
+	numa_for_slabs(size_t(m_dims[2]), [&](size_t z0, size_t z1) {
+		std::copy(other.m_data.begin() + z0 * slab, other.m_data.begin() + z1 * slab, m_data.begin() + z0 * slab);
+	});
+	m_index = other.m_index;
+	m_spectrum = other.m_spectrum;
+	return *this;
+}
+
+inline volume& volume::operator=(volume&& other) noexcept {
+	if (this == &other) return *this;
+	m_data = std::move(other.m_data);
 	m_dims = other.m_dims;
+	m_placement = other.m_placement;
+	m_index = std::move(other.m_index);
+	m_spectrum = std::move(other.m_spectrum);
+	other.clear();
 	return *this;
 }
 
@@ -141,14 +144,39 @@ inline bool volume::empty(void) const {
 inline void volume::clear(void) {
 	m_data.clear();
 	m_dims = { 0,0,0 };
+	m_index.reset();
+	m_spectrum.reset();
 }
 
 inline void volume::resize(int dimx, int dimy, int dimz) {
 	assert("volume::resize() -- invalid argument(s)" && dimx >= 0 && dimy >= 0 && dimz >= 0);
 	size_t s = size_t(dimx) * size_t(dimy) * size_t(dimz);
 	if (s == 0) return clear();
-	m_data.resize(s);
+	if (s != m_data.size()) {
+		// Fresh pages, zeroed by the threads that will extract these slabs, so
+		// that every slab lives on the node that processes it (see numa.h).
+		decltype(m_data)().swap(m_data);
+		m_data.resize(s);
+		numa_place(m_data.data(), s * sizeof(float), m_placement);
+		const size_t slab = size_t(dimx) * size_t(dimy);
+		numa_for_slabs(size_t(dimz), [&](size_t z0, size_t z1) {
+			std::fill(m_data.begin() + z0 * slab, m_data.begin() + z1 * slab, 0.0f);
+		});
+	}
 	m_dims = { dimx,dimy,dimz };
+	m_index.reset();
+	m_spectrum.reset();
+}
+
+inline void volume::place(numa_placement placement) {
+	m_placement = placement;
+	if (empty()) return;
+	volume moved(std::move(*this));
+	copy_from(moved);
+}
+
+inline numa_placement volume::placement(void) const {
+	return m_placement;
 }
 
 inline float& volume::operator()(int i, int j, int k) {
@@ -182,6 +210,33 @@ inline size_t volume::linear_address(int i, int j, int k) const {
 	return size_t(i) + size_t(m_dims[0]) * (size_t(j) + size_t(m_dims[1]) * size_t(k));
 }
 
+inline void volume::build_index(int nBuckets) {
+	if (m_data.size() > value_index::MAX_SIZE) {
+		m_index.reset();
+		return;
+	}
+	m_index = std::make_shared<const value_index>(m_data.data(), m_data.size(), nBuckets);
+}
+
+inline const value_index* volume::index(void) const {
+	return m_index.get();
+}
+
+inline void volume::build_spectrum(int nSamples, thread_pool* pool) {
+	m_spectrum = std::make_shared<const contour_spectrum>(m_data.data(), m_dims, nSamples, pool);
+}
+
+inline const contour_spectrum* volume::spectrum(void) const {
+	return m_spectrum.get();
+}
+
+template<class F>
+inline bool volume::for_each_between(float lo, float hi, F f) const {
+	if (!m_index) return false;
+	m_index->for_each_between(m_data.data(), lo, hi, f);
+	return true;
+}
+
 inline bool volume::import_dat(const std::string& name) {
 	std::ifstream stream(name, std::ifstream::binary | std::ifstream::in);
 	if (!stream.good()) return false;
@@ -204,9 +259,94 @@ inline bool volume::import_dat(const std::string& name) {
 		return false;
 	}
 	resize(dims[0], dims[1], dims[2]);
+	m_index.reset();
+	m_spectrum.reset();
 	for (size_t n = 0; n < size(); n++) m_data[n] = float(buf[n]) / 4095.0f;
 	stream.close();
 	return true;
 }
 
+inline volume::volume(const volume_view& V) : m_dims({ 0,0,0 }), m_placement(NUMA_FIRST_TOUCH) {
+	// copy slab by slab on the threads that first touched them, like copy_from()
+	resize(int(V.dimension(0)), int(V.dimension(1)), int(V.dimension(2)));
+	if (empty()) return;
+	numa_for_slabs(size_t(m_dims[2]), [&](size_t z0, size_t z1) {
+		for (int k = int(z0); k < int(z1); k++) {
+			for (int j = 0; j < m_dims[1]; j++) {
+				const float* v = V.data() + V.address(0, j, k);
+				float* row = &m_data[linear_address(0, j, k)];
+				if (V.stride(0) == 1) std::copy(v, v + m_dims[0], row);
+				else for (int i = 0; i < m_dims[0]; i++) row[i] = v[ptrdiff_t(i) * V.stride(0)];
+			}
+		}
+	});
+}
+
+inline volume_view volume::view(void) const {
+	const std::array<ptrdiff_t, 3> strides = { 1, ptrdiff_t(m_dims[0]), ptrdiff_t(m_dims[0]) * ptrdiff_t(m_dims[1]) };
+	return volume_view(m_data.data(), m_dims, strides, vec3i(0, 0, 0), 1, m_index.get(), m_spectrum.get());
+}
+
+inline volume_view volume::view(const vec3i& lo, const vec3i& hi, int step) const {
+	return view().view(lo, hi, step);
+}
+
+inline bool volume::export_dat(const std::string& name) const {
+	return view().export_dat(name);
+}
+
+inline volume volume_view::subsampled(void) const {
+	// TASK 3b: implement subsampling to half the volume's resolution
+	//          along each dimension. To do so, first create a new
+	//          result volume of resolution (m_dims[0]+1)/2,
+	//		    (m_dims[1]+1)/2, (m_dims[2]+1)/2 (rounding up).
+	//		    Then, for each voxel in new volume, average
+	//          over the corresponding voxels in "Vol". 
+	//          Most voxels will be the average of a 2x2x2 region,
+	//          but you need to pay attention at the boundary if
+	//		    one of the m_dims is odd...
+	const volume_view& Vol(*this); // short-hand variable "Vol" is this object.
+
+	// 1. create result volume of correct size
+	volume result((m_dims[0] + 1) / 2, (m_dims[1] + 1) / 2, (m_dims[2] + 1) / 2);
+
+	// 2. iterate all voxels in input volume
+	// HINT: See below code, which in Python translates to
+	//       "kmax = 2*k+1 if 2*k+1<Vol.dimension(2) else 2*k
+	for (int k = 0; k < result.dimension(2); k++) {
+		int kmax = 2 * k + 1 < Vol.dimension(2) ? 2 * k + 1 : 2 * k;
+		for (int j = 0; j < result.dimension(1); j++) {
+			int jmax = 2 * j + 1 < Vol.dimension(1) ? 2 * j + 1 : 2 * j;
+			for (int i = 0; i < result.dimension(0); i++) {
+				int imax = 2 * i + 1 < Vol.dimension(0) ? 2 * i + 1 : 2 * i;
+				for (int z = 2 * k; z < kmax + 1; z++) {
+					for (int y = 2 * j; y < jmax + 1; y++) {
+						for (int x = 2 * i; x < imax + 1; x++) {
+							result(i, j, k) += Vol(x, y, z);
+
+						}
+					}
+				}
+				result(i, j, k) /= (float(imax + 1 - 2 * i)) * (float(jmax + 1 - 2 * j)) * (float(kmax + 1 - 2 * k));
+			}
+		}
+	// Now proceed analogously for j,i
+		
+	
+	
+				// Finally, you need three more loops to collect relevant voxels from Vol
+				// These loops run from 2*{i,j,k} to (including!) {imax,jmax,kmax}. 
+				// Make sure to divide the average by the correct number of voxels
+				
+
+
+
+				// Now, divide by float(nVoxels)
+		
+
+	}
+	// Finally, return the result
+	return result;
+}
+
 #endif
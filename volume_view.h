@@ -0,0 +1,184 @@
+#ifndef __VOLUME_VIEW_H__
+#define __VOLUME_VIEW_H__
+
+#include<array>
+#include<cassert>
+#include<cstddef>
+#include<cmath>
+#include<fstream>
+#include<string>
+#include<vector>
+#include<algorithm>
+#include<inttypes.h>
+#include"ext_math.h"
+#include"value_index.h"
+#include"contour_spectrum.h"
+
+class volume;
+
+// A box of voxels of a volume without a copy of them: a pointer to the first
+// voxel, the dimensions and the strides (in floats) between neighbors along
+// x, y and z. A sub-box keeps the strides of the volume, a single slice is a
+// box one voxel thick, a preview taking every step-th voxel multiplies them.
+// origin() and step() locate the view in the grid of the volume it was taken
+// from: voxel p of the view is voxel origin()+step()*p there.
+// The view does not own the voxels, the volume has to outlive it and must not
+// be resized in the meantime. Views of views are views of the same storage.
+// Voxels are addressed like in a volume of the view's dimensions
+// (linear_address()), address() is where they actually are relative to data().
+// Only a view of a whole volume carries its index() and spectrum().
+class volume_view {
+public:
+	inline volume_view(void);									// empty view
+	inline volume_view(const float* data, const std::array<int, 3>& dims, const std::array<ptrdiff_t, 3>& strides,
+		const vec3i& origin = vec3i(0, 0, 0), int step = 1, const value_index* index = nullptr, const contour_spectrum* spectrum = nullptr);
+	inline size_t dimension(size_t n) const;					// number of voxels along axis n
+	inline size_t size(void) const;								// total number of voxels
+	inline bool empty(void) const;
+	inline ptrdiff_t stride(size_t n) const;					// floats between neighbors along axis n
+	inline bool contiguous(void) const;							// true if voxel n is data()[n], like in a volume
+	inline const float* data(void) const;						// voxel 0,0,0
+	inline const vec3i& origin(void) const;						// voxel 0,0,0 in the volume viewed
+	inline int step(void) const;								// voxels of the volume viewed per voxel of the view
+	inline const float& operator()(int i, int j, int k) const;	// read-only access to voxel at ijk
+	inline const float& operator()(const vec3i& vox) const;
+	inline size_t linear_address(int i, int j, int k) const;	// position of voxel ijk in a dense volume of the same dimensions
+	inline ptrdiff_t address(int i, int j, int k) const;		// position of voxel ijk in memory, relative to data()
+	inline volume_view view(const vec3i& lo, const vec3i& hi, int step = 1) const;	// voxels lo..hi-1, every step-th along each axis
+	inline volume subsampled(void) const;						// half the resolution, see volume::subsampled()
+	inline bool export_dat(const std::string& name) const;		// volume exporter, the format of volume::import_dat()
+	inline const value_index* index(void) const;				// see volume::index()
+	template<class F>
+	inline bool for_each_between(float lo, float hi, F f) const;	// f(n) for voxels with lo < value <= hi. RETURNS false without index
+	inline const contour_spectrum* spectrum(void) const;		// see volume::spectrum()
+protected:
+	const float* m_data;
+	std::array<int, 3> m_dims;
+	std::array<ptrdiff_t, 3> m_strides;
+	vec3i m_origin;
+	int m_step;
+	const value_index* m_index;
+	const contour_spectrum* m_spectrum;
+};
+
+inline volume_view::volume_view(void) : m_data(nullptr), m_dims({ 0,0,0 }), m_strides({ 1,0,0 }), m_origin(0, 0, 0), m_step(1), m_index(nullptr), m_spectrum(nullptr) {
+}
+
+inline volume_view::volume_view(const float* data, const std::array<int, 3>& dims, const std::array<ptrdiff_t, 3>& strides,
+	const vec3i& origin, int step, const value_index* index, const contour_spectrum* spectrum)
+	: m_data(data), m_dims(dims), m_strides(strides), m_origin(origin), m_step(step), m_index(index), m_spectrum(spectrum) {
+	assert("volume_view -- invalid argument(s)" && dims[0] >= 0 && dims[1] >= 0 && dims[2] >= 0 && step > 0);
+	if (size() == 0) {
+		m_data = nullptr;
+		m_dims = { 0,0,0 };
+	}
+	// the index addresses voxels by their position in memory
+	assert("volume_view -- index of a view that is not contiguous" && (index == nullptr || contiguous()));
+}
+
+inline size_t volume_view::dimension(size_t n) const {
+	assert("volume_view::dimension() -- invalid argument" && n < 3);
+	return m_dims[n];
+}
+
+inline size_t volume_view::size(void) const {
+	return size_t(m_dims[0]) * size_t(m_dims[1]) * size_t(m_dims[2]);
+}
+
+inline bool volume_view::empty(void) const {
+	return m_data == nullptr;
+}
+
+inline ptrdiff_t volume_view::stride(size_t n) const {
+	assert("volume_view::stride() -- invalid argument" && n < 3);
+	return m_strides[n];
+}
+
+inline bool volume_view::contiguous(void) const {
+	return m_strides[0] == 1 && m_strides[1] == ptrdiff_t(m_dims[0]) && m_strides[2] == ptrdiff_t(m_dims[0]) * ptrdiff_t(m_dims[1]);
+}
+
+inline const float* volume_view::data(void) const {
+	return m_data;
+}
+
+inline const vec3i& volume_view::origin(void) const {
+	return m_origin;
+}
+
+inline int volume_view::step(void) const {
+	return m_step;
+}
+
+inline const float& volume_view::operator()(int i, int j, int k) const {
+	return m_data[address(i, j, k)];
+}
+
+inline const float& volume_view::operator()(const vec3i& vox) const {
+	return m_data[address(vox.x, vox.y, vox.z)];
+}
+
+inline size_t volume_view::linear_address(int i, int j, int k) const {
+	assert("volume_view::linear_address() -- invalid argument(s)" && i >= 0 && i < m_dims[0] && j >= 0 && j < m_dims[1] && k >= 0 && k < m_dims[2]);
+	return size_t(i) + size_t(m_dims[0]) * (size_t(j) + size_t(m_dims[1]) * size_t(k));
+}
+
+inline ptrdiff_t volume_view::address(int i, int j, int k) const {
+	assert("volume_view::address() -- invalid argument(s)" && i >= 0 && i < m_dims[0] && j >= 0 && j < m_dims[1] && k >= 0 && k < m_dims[2]);
+	return ptrdiff_t(i) * m_strides[0] + ptrdiff_t(j) * m_strides[1] + ptrdiff_t(k) * m_strides[2];
+}
+
+inline volume_view volume_view::view(const vec3i& lo, const vec3i& hi, int step) const {
+	assert("volume_view::view() -- invalid argument(s)" && step > 0);
+	std::array<int, 3> dims;
+	vec3i first;
+	for (int i = 0; i < 3; i++) {
+		first[i] = std::max(lo[i], 0);
+		int last = std::min(hi[i], m_dims[i]);
+		dims[i] = last > first[i] ? (last - first[i] + step - 1) / step : 0;
+	}
+	if (dims[0] == 0 || dims[1] == 0 || dims[2] == 0) return volume_view();
+	const std::array<ptrdiff_t, 3> strides = { m_strides[0] * step, m_strides[1] * step, m_strides[2] * step };
+	return volume_view(m_data + address(first.x, first.y, first.z), dims, strides, m_origin + first * m_step, m_step * step);
+}
+
+inline bool volume_view::export_dat(const std::string& name) const {
+	// 3 x uint16 dimensions, then the voxels as uint16, x fastest, scaled
+	// like import_dat() reads them
+	if (m_dims[0] > 65535 || m_dims[1] > 65535 || m_dims[2] > 65535) return false;
+	std::ofstream stream(name, std::ofstream::binary | std::ofstream::out);
+	if (!stream.good()) return false;
+	const uint16_t dims[3] = { uint16_t(m_dims[0]), uint16_t(m_dims[1]), uint16_t(m_dims[2]) };
+	stream.write(reinterpret_cast<const char*>(dims), 3 * sizeof(uint16_t));
+	std::vector<uint16_t> row((size_t(m_dims[0])));
+	for (int k = 0; k < m_dims[2]; k++) {
+		for (int j = 0; j < m_dims[1]; j++) {
+			const float* v = m_data + address(0, j, k);
+			for (int i = 0; i < m_dims[0]; i++) {
+				float raw = std::round(v[ptrdiff_t(i) * m_strides[0]] * 4095.0f);
+				row[i] = uint16_t(raw > 0.0f ? std::min(raw, 65535.0f) : 0.0f);	// NaN goes to 0 as well
+			}
+			stream.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(uint16_t));
+		}
+	}
+	return stream.good();
+}
+
+inline const value_index* volume_view::index(void) const {
+	return m_index;
+}
+
+template<class F>
+inline bool volume_view::for_each_between(float lo, float hi, F f) const {
+	if (!m_index) return false;
+	m_index->for_each_between(m_data, lo, hi, f);
+	return true;
+}
+
+inline const contour_spectrum* volume_view::spectrum(void) const {
+	return m_spectrum;
+}
+
+// volume_view::subsampled() is defined in volume.h, after volume
+
+#endif